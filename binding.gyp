@@ -1,4 +1,8 @@
 {
+  "variables": {
+    "lua_nanboxing%": 0,
+    "lua_jit%": 0
+  },
   "targets": [
     {
       "target_name": "luajs",
@@ -6,6 +10,7 @@
         "src/luajs.cc",
         "src/luastate.cpp",
         "src/luajs_utils.cpp",
+        "src/luaprofiler.cpp",
         "src/lua/lapi.c",
         "src/lua/lauxlib.c",
         "src/lua/lbaselib.c",
@@ -20,6 +25,7 @@
         "src/lua/lfunc.c",
         "src/lua/lgc.c",
         "src/lua/linit.c",
+        "src/lua/ljit.c",
         "src/lua/liolib.c",
         "src/lua/llex.c",
         "src/lua/lmathlib.c",
@@ -31,6 +37,7 @@
         "src/lua/lparser.c",
         "src/lua/lstate.c",
         "src/lua/lstring.c",
+        "src/lua/lstrbuflib.c",
         "src/lua/lstrlib.c",
         "src/lua/ltable.c",
         "src/lua/ltablib.c",
@@ -52,6 +59,12 @@
                 'xcode_settings': {
                   'GCC_ENABLE_CPP_EXCEPTIONS': 'YES'
                 }
+              }],
+              ['lua_nanboxing==1', {
+                'defines': [ 'LUA_NANBOXING' ]
+              }],
+              ['lua_jit==1 and OS=="linux" and target_arch=="x64"', {
+                'defines': [ 'LUA_USE_JIT' ]
               }]
             ]
     }
@@ -115,6 +115,35 @@ LUA_API int lua_checkstack (lua_State *L, int n) {
 }
 
 
+/*
+** to be called by 'lua_reservestack' in protected mode, to allocate the
+** reserved stack and CallInfos capturing memory errors
+*/
+static void reserve (lua_State *L, void *ud) {
+  UNUSED(ud);
+  if (L->stacksize < L->stackreserve)
+    luaD_reallocstack(L, L->stackreserve);
+  luaE_reserveCI(L);
+}
+
+
+LUA_API int lua_reservestack (lua_State *L, int n, int ncalls) {
+  int res;
+  lua_lock(L);
+  api_check(L, n >= 0 && ncalls >= 0 && ncalls <= USHRT_MAX,
+               "invalid reserve");
+  if (n > LUAI_MAXSTACK - EXTRA_STACK)  /* cannot keep that much? */
+    res = 0;
+  else {
+    L->stackreserve = n + EXTRA_STACK;
+    L->cireserve = cast(unsigned short, ncalls);
+    res = (luaD_rawrunprotected(L, &reserve, NULL) == LUA_OK);
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
 LUA_API void lua_xmove (lua_State *from, lua_State *to, int n) {
   int i;
   if (from == to) return;
@@ -372,6 +401,7 @@ LUA_API int lua_toboolean (lua_State *L, int idx) {
 
 LUA_API const char *lua_tolstring (lua_State *L, int idx, size_t *len) {
   StkId o = index2addr(L, idx);
+  const char *s;
   if (!ttisstring(o)) {
     if (!cvt2str(o)) {  /* not convertible? */
       if (len != NULL) *len = 0;
@@ -385,7 +415,21 @@ LUA_API const char *lua_tolstring (lua_State *L, int idx, size_t *len) {
   }
   if (len != NULL)
     *len = vslen(o);
-  return svalue(o);
+  lua_lock(L);  /* 'luaS_tocstr' may allocate a block */
+  s = luaS_tocstr(L, tsvalue(o));
+  lua_unlock(L);
+  return s;
+}
+
+
+/*
+** Writes the number at 'idx' into 'buff' as 'lua_tolstring' would
+** convert it, but without creating a string. Returns its length (the
+** result is not zero-terminated), or 0 if the value is not a number.
+*/
+LUA_API size_t lua_numbertobuff (lua_State *L, int idx, char *buff) {
+  StkId o = index2addr(L, idx);
+  return ttisnumber(o) ? luaO_tostringbuff(o, buff) : 0;
 }
 
 
@@ -564,6 +608,10 @@ LUA_API void lua_pushboolean (lua_State *L, int b) {
 
 LUA_API void lua_pushlightuserdata (lua_State *L, void *p) {
   lua_lock(L);
+#if defined(LUA_NANBOXING)
+  api_check(L, (cast(size_t, p) & ~cast(size_t, NBPAYLOAD)) == 0,
+                "light userdata pointer out of range");
+#endif
   setpvalue(L->top, p);
   api_incr_top(L);
   lua_unlock(L);
@@ -1068,7 +1116,9 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
     case LUA_GCSTEP: {
       l_mem debt = 1;  /* =1 to signal that it did an actual step */
       lu_byte oldrunning = g->gcrunning;
+      l_mem oldidlelimit = g->gcidlelimit;
       g->gcrunning = 1;  /* allow GC to run */
+      g->gcidlelimit = 0;  /* explicit steps are never deferred */
       if (data == 0) {
         luaE_setdebt(g, -GCSTEPSIZE);  /* to do a "small" step */
         luaC_step(L);
@@ -1079,6 +1129,7 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
         luaC_checkGC(L);
       }
       g->gcrunning = oldrunning;  /* restore previous state */
+      g->gcidlelimit = oldidlelimit;
       if (debt > 0 && g->gcstate == GCSpause)  /* end of cycle? */
         res = 1;  /* signal it */
       break;
@@ -1098,6 +1149,19 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCSETIDLE: {  /* 'data' is the deferred-debt limit in Kbytes */
+      res = cast_int(g->gcidlelimit >> 10);
+      g->gcidlelimit = (data > 0) ? cast(l_mem, data) * 1024 : 0;
+      if (data <= 0) {  /* leaving idle mode? */
+        luaE_setdebt(g, g->GCdebt + g->GCdeferred);  /* restore debt */
+        g->GCdeferred = 0;
+      }
+      break;
+    }
+    case LUA_GCIDLESTEP: {  /* 'data' is the time budget in microseconds */
+      res = luaC_idlestep(L, cast(double, data) * 1000);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -1105,6 +1169,69 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 }
 
 
+LUA_API void lua_gcstats (lua_State *L, lua_GCStats *stats, int reset) {
+  global_State *g;
+  lua_lock(L);
+  g = G(L);
+  if (stats != NULL) {
+    *stats = g->gcstats;
+    stats->pause = g->gcpause;
+    stats->stepmul = g->gcstepmul;
+  }
+  if (reset)
+    memset(&g->gcstats, 0, sizeof(g->gcstats));
+  lua_unlock(L);
+}
+
+
+LUA_API int lua_callstats (lua_State *L, int on) {
+  int res;
+  lua_lock(L);
+  res = G(L)->callstats;
+  G(L)->callstats = (on != 0);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Report every prototype that has been called; prototypes already
+** collected take their statistics with them.
+*/
+LUA_API void lua_funcstats (lua_State *L, lua_FuncStatsF f, void *ud,
+                            int reset) {
+  global_State *g;
+  GCObject *o;
+  double ticks, scale = 1;
+  lua_lock(L);
+  g = G(L);
+  ticks = cast_num(luai_ticks() - g->ticks0);
+  if (ticks > 0)  /* can convert ticks to nanoseconds? */
+    scale = (luaE_nanotime() - g->nanos0) / ticks;
+  for (o = g->allgc; o != NULL; o = o->next) {
+    if (o->tt == LUA_TPROTO) {
+      Proto *p = gco2p(o);
+      if (p->calls > 0 && f != NULL) {
+        lua_FuncStats fs;
+        char buff[LUA_IDSIZE];
+        luaO_chunkid(buff, p->source ? getstr(p->source) : "=?", LUA_IDSIZE);
+        fs.source = buff;
+        fs.linedefined = p->linedefined;
+        fs.calls = p->calls;
+        fs.selftime = p->selftime * scale;
+        fs.totaltime = p->totaltime * scale;
+        (*f)(ud, &fs);
+      }
+      if (reset) {
+        p->calls = 0;
+        p->selftime = p->totaltime = 0;
+      }
+    }
+  }
+  lua_unlock(L);
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -1181,6 +1308,56 @@ LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
 }
 
 
+/*
+** Enables or disables the compilation of hot functions to machine
+** code (LUA_USE_JIT); returns whether it was enabled.
+*/
+LUA_API int lua_setjit (lua_State *L, int on) {
+  int res;
+  lua_lock(L);
+#if defined(LUA_USE_JIT)
+  res = !G(L)->jitoff;
+  G(L)->jitoff = !on;
+#else
+  UNUSED(L); UNUSED(on);
+  res = 0;
+#endif
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Sorts the first 'n' elements of the table at 'idx' in ascending order
+** directly in its array part, if they are there and are all numbers or
+** all strings; returns 0 (and does nothing) otherwise.
+*/
+LUA_API int lua_sortarray (lua_State *L, int idx, lua_Integer n) {
+  const TValue *t;
+  int res;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(L, n >= 0, "negative size");
+  res = ttistable(t) && luaH_sortarray(L, hvalue(t), l_castS2U(n));
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Removes all entries of the table at 'idx', keeping the memory of its
+** array and hash parts for the entries that will be added next.
+*/
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  const TValue *t;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(L, ttistable(t), "table expected");
+  luaH_clear(L, hvalue(t));
+  lua_unlock(L);
+}
+
+
 LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
   Udata *u;
   lua_lock(L);
@@ -106,6 +106,9 @@ LUALIB_API void (luaL_traceback) (lua_State *L, lua_State *L1,
 LUALIB_API void (luaL_requiref) (lua_State *L, const char *modname,
                                  lua_CFunction openf, int glb);
 
+/* contents of a 'strbuf' buffer (defined in lstrbuflib.c) */
+LUALIB_API const char *(luaL_tostrbuf) (lua_State *L, int idx, size_t *len);
+
 /*
 ** ===============================================================
 ** some useful macros
@@ -12,6 +12,7 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -286,6 +287,21 @@ void luaK_patchclose (FuncState *fs, int list, int level) {
 }
 
 
+/*
+** Turn the previous instruction into a superinstruction when it is
+** commonly followed by 'i'. (See notes in lopcodes.h.)
+*/
+static void fuse (FuncState *fs, Instruction i) {
+  if (fs->pc > 0) {
+    Instruction *previous = &fs->f->code[fs->pc - 1];
+    if (GET_OPCODE(*previous) == OP_GETTABUP && GET_OPCODE(i) == OP_GETTABLE)
+      SET_OPCODE(*previous, OP_GETTABUPTAB);
+    else if (GET_OPCODE(*previous) == OP_ADD && GET_OPCODE(i) == OP_FORLOOP)
+      SET_OPCODE(*previous, OP_ADDFORLOOP);
+  }
+}
+
+
 /*
 ** Emit instruction 'i', checking for array sizes and saving also its
 ** line information. Return 'i' position.
@@ -293,6 +309,7 @@ void luaK_patchclose (FuncState *fs, int list, int level) {
 static int luaK_code (FuncState *fs, Instruction i) {
   Proto *f = fs->f;
   dischargejpc(fs);  /* 'pc' will change */
+  fuse(fs, i);
   /* put new instruction in code array */
   luaM_growvector(fs->ls->L, f->code, fs->pc, f->sizecode, Instruction,
                   MAX_INT, "opcodes");
@@ -1201,3 +1218,302 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+
+/*
+** {======================================================
+** Peephole optimizer
+** =======================================================
+*/
+
+/* per-instruction flags; the new position of each instruction is kept
+   above them during compaction */
+#define OPT_TARGET	1  /* instruction is a jump target */
+#define OPT_DEAD	2  /* instruction will be removed */
+#define OPT_REACHED	4  /* instruction is reachable */
+#define OPT_FLAGS	3  /* number of flag bits */
+
+#define newpos(info,pc)	((info)[pc] >> OPT_FLAGS)
+
+/* most hops followed when threading a jump (there may be cycles) */
+#define MAXTHREAD	100
+
+
+/*
+** Does instruction 'i' depend on the one after it? Tests and LOADBOOL
+** skip it, superinstructions execute it, and LOADKX and SETLIST may
+** take their argument from it.
+*/
+static int tiednext (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_LOADBOOL: return GETARG_C(i) != 0;
+    case OP_SETLIST: return GETARG_C(i) == 0;
+    case OP_LOADKX: case OP_GETTABUPTAB: case OP_ADDFORLOOP: return 1;
+    default: return testTMode(GET_OPCODE(i));
+  }
+}
+
+
+/*
+** Destination of a jumping instruction at 'pc', or -1.
+*/
+static int jumpdest (Instruction i, int pc) {
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: case OP_FORLOOP: case OP_FORPREP: case OP_TFORLOOP:
+      return pc + 1 + GETARG_sBx(i);
+    default: return -1;
+  }
+}
+
+
+/*
+** Can live instruction 'pc' be removed or changed on its own?
+*/
+static int isfree (FuncState *fs, int *info, int pc) {
+  return !(pc > 0 && !(info[pc - 1] & OPT_DEAD) &&
+           tiednext(fs->f->code[pc - 1]));
+}
+
+
+static void marktargets (FuncState *fs, int *info) {
+  Instruction *code = fs->f->code;
+  int pc;
+  for (pc = 0; pc <= fs->pc; pc++)
+    info[pc] &= ~OPT_TARGET;
+  for (pc = 0; pc < fs->pc; pc++) {
+    int dest = jumpdest(code[pc], pc);
+    if (info[pc] & OPT_DEAD) continue;
+    if (dest >= 0)
+      info[dest] |= OPT_TARGET;
+    if ((testTMode(GET_OPCODE(code[pc])) ||
+        (GET_OPCODE(code[pc]) == OP_LOADBOOL && GETARG_C(code[pc]))) &&
+        pc + 2 <= fs->pc)
+      info[pc + 2] |= OPT_TARGET;  /* skip */
+  }
+}
+
+
+/*
+** Result of comparing two constants without metamethods or locale
+** dependencies; return 0 if it cannot be known at compile time.
+*/
+static int constcompare (FuncState *fs, Instruction i, int *res) {
+  const TValue *rb, *rc;
+  if (!ISK(GETARG_B(i)) || !ISK(GETARG_C(i)))
+    return 0;
+  rb = &fs->f->k[INDEXK(GETARG_B(i))];
+  rc = &fs->f->k[INDEXK(GETARG_C(i))];
+  if (GET_OPCODE(i) == OP_EQ)
+    *res = luaV_rawequalobj(rb, rc);
+  else if (ttisinteger(rb) && ttisinteger(rc))
+    *res = (GET_OPCODE(i) == OP_LT) ? ivalue(rb) < ivalue(rc)
+                                    : ivalue(rb) <= ivalue(rc);
+  else if (ttisfloat(rb) && ttisfloat(rc))
+    *res = (GET_OPCODE(i) == OP_LT) ? luai_numlt(fltvalue(rb), fltvalue(rc))
+                                    : luai_numle(fltvalue(rb), fltvalue(rc));
+  else
+    return 0;
+  return 1;
+}
+
+
+/*
+** Fold comparisons between constants: the test goes away and its jump
+** either becomes unconditional or goes away too.
+*/
+static void foldcompares (FuncState *fs, int *info) {
+  Instruction *code = fs->f->code;
+  int pc, res;
+  for (pc = 0; pc + 1 < fs->pc; pc++) {
+    OpCode op = GET_OPCODE(code[pc]);
+    if ((op == OP_EQ || op == OP_LT || op == OP_LE) &&
+        !(info[pc] & OPT_DEAD) && isfree(fs, info, pc) &&
+        !(info[pc + 1] & (OPT_TARGET | OPT_DEAD)) &&
+        constcompare(fs, code[pc], &res)) {
+      lua_assert(GET_OPCODE(code[pc + 1]) == OP_JMP);
+      info[pc] |= OPT_DEAD;
+      if (res != GETARG_A(code[pc]))  /* never jumps? */
+        info[pc + 1] |= OPT_DEAD;
+    }
+  }
+}
+
+
+/*
+** Make jumps to unconditional jumps that close no upvalues go directly
+** to their final destination; removed instructions are skipped, as
+** they would just fall through.
+*/
+static void threadjumps (FuncState *fs, int *info) {
+  Instruction *code = fs->f->code;
+  int pc;
+  for (pc = 0; pc < fs->pc; pc++) {
+    if (GET_OPCODE(code[pc]) == OP_JMP && !(info[pc] & OPT_DEAD)) {
+      int dest = jumpdest(code[pc], pc);
+      int hops;
+      for (hops = 0; hops < MAXTHREAD && dest < fs->pc; hops++) {
+        if (info[dest] & OPT_DEAD)
+          dest++;
+        else if (GET_OPCODE(code[dest]) == OP_JMP && GETARG_A(code[dest]) == 0)
+          dest = jumpdest(code[dest], dest);
+        else
+          break;
+      }
+      if (abs(dest - (pc + 1)) <= MAXARG_sBx)
+        SETARG_sBx(code[pc], dest - (pc + 1));
+      if (dest == pc + 1 && GETARG_A(code[pc]) == 0 && isfree(fs, info, pc))
+        info[pc] |= OPT_DEAD;  /* jump to next instruction */
+    }
+  }
+}
+
+
+/*
+** Remove moves that undo the previous one or copy a register to itself,
+** and merge consecutive LOADNILs.
+*/
+static void removemoves (FuncState *fs, int *info) {
+  Instruction *code = fs->f->code;
+  int pc;
+  for (pc = 0; pc < fs->pc; pc++) {
+    Instruction i = code[pc];
+    int next = pc + 1;
+    if ((info[pc] & OPT_DEAD) || !isfree(fs, info, pc))
+      continue;
+    while (next < fs->pc && (info[next] & (OPT_TARGET | OPT_DEAD)) == OPT_DEAD)
+      next++;  /* skip removed instructions nothing jumps to */
+    if (GET_OPCODE(i) == OP_MOVE && GETARG_A(i) == GETARG_B(i))
+      info[pc] |= OPT_DEAD;
+    else if (next < fs->pc && !(info[next] & (OPT_TARGET | OPT_DEAD))) {
+      Instruction n = code[next];
+      if (GET_OPCODE(i) == OP_MOVE && GET_OPCODE(n) == OP_MOVE &&
+          GETARG_A(i) == GETARG_B(n) && GETARG_B(i) == GETARG_A(n))
+        info[next] |= OPT_DEAD;
+      else if (GET_OPCODE(i) == OP_LOADNIL && GET_OPCODE(n) == OP_LOADNIL) {
+        int from = GETARG_A(i), to = from + GETARG_B(i);
+        int nfrom = GETARG_A(n), nto = nfrom + GETARG_B(n);
+        if (nfrom <= to + 1 && from <= nto + 1 &&  /* contiguous? */
+            (nto > to ? nto : to) - (nfrom < from ? nfrom : from) <= MAXARG_B) {
+          from = (nfrom < from) ? nfrom : from;
+          to = (nto > to) ? nto : to;
+          SETARG_A(code[pc], from);
+          SETARG_B(code[pc], to - from);
+          info[next] |= OPT_DEAD;
+          pc--;  /* try to merge the following one too */
+        }
+      }
+    }
+  }
+}
+
+
+/*
+** Mark instructions that cannot be reached from the entry point as
+** dead. Instructions tied to a reachable one are kept as well.
+*/
+static void removeunreachable (FuncState *fs, int *info) {
+  Instruction *code = fs->f->code;
+  int pc, again;
+  info[0] |= OPT_REACHED;
+  do {  /* propagate until nothing changes (backward jumps) */
+    again = 0;
+    for (pc = 0; pc < fs->pc; pc++) {
+      Instruction i = code[pc];
+      int succ[2], n = 0, s;
+      if (!(info[pc] & OPT_REACHED))
+        continue;
+      if (info[pc] & OPT_DEAD)  /* removed instructions fall through */
+        succ[n++] = pc + 1;
+      else {
+        switch (GET_OPCODE(i)) {
+          case OP_RETURN: break;
+          case OP_JMP: case OP_FORPREP:
+            succ[n++] = jumpdest(i, pc);
+            break;
+          case OP_FORLOOP: case OP_TFORLOOP:
+            succ[n++] = pc + 1;
+            succ[n++] = jumpdest(i, pc);
+            break;
+          case OP_LOADBOOL:
+            succ[n++] = pc + 1;  /* keep the skipped instruction */
+            if (GETARG_C(i)) succ[n++] = pc + 2;
+            break;
+          default:
+            succ[n++] = pc + 1;
+            if (testTMode(GET_OPCODE(i)))
+              succ[n++] = pc + 2;
+            break;
+        }
+      }
+      for (s = 0; s < n; s++) {
+        if (succ[s] < fs->pc && !(info[succ[s]] & OPT_REACHED)) {
+          info[succ[s]] |= OPT_REACHED;
+          if (succ[s] < pc) again = 1;
+        }
+      }
+    }
+  } while (again);
+  for (pc = 0; pc < fs->pc; pc++)
+    if (!(info[pc] & OPT_REACHED))
+      info[pc] |= OPT_DEAD;
+}
+
+
+/*
+** Squeeze out removed instructions, fixing jumps, line information and
+** the ranges of local variables. Return whether anything was removed.
+*/
+static int compact (FuncState *fs, int *info) {
+  Proto *f = fs->f;
+  int pc, n = 0;
+  for (pc = 0; pc <= fs->pc; pc++) {  /* compute new positions */
+    info[pc] = (info[pc] & ((1 << OPT_FLAGS) - 1)) | (n << OPT_FLAGS);
+    if (pc < fs->pc && !(info[pc] & OPT_DEAD)) n++;
+  }
+  if (n == fs->pc)
+    return 0;
+  for (pc = 0; pc < fs->pc; pc++) {
+    Instruction i = f->code[pc];
+    int dest = jumpdest(i, pc);
+    if (info[pc] & OPT_DEAD) continue;
+    if (dest >= 0)
+      SETARG_sBx(i, newpos(info, dest) - (newpos(info, pc) + 1));
+    f->code[newpos(info, pc)] = i;
+    f->lineinfo[newpos(info, pc)] = f->lineinfo[pc];
+  }
+  for (pc = 0; pc < fs->nlocvars; pc++) {
+    LocVar *var = &f->locvars[pc];
+    var->startpc = newpos(info, var->startpc);
+    var->endpc = newpos(info, var->endpc);
+  }
+  fs->pc = n;
+  return 1;
+}
+
+
+/*
+** Optimize the finished code of 'fs' (when loading with mode 'o'):
+** fold comparisons between constants, thread jumps, remove useless
+** moves and unreachable code. Removing code can open new chances
+** (e.g., a jump that now goes to the next instruction), so it repeats
+** a few times.
+*/
+void luaK_optimize (FuncState *fs) {
+  lua_State *L = fs->ls->L;
+  int size = fs->pc + 1;
+  int *info = luaM_newvector(L, size, int);
+  int round = 0;
+  lua_assert(fs->pc < (MAX_INT >> OPT_FLAGS));
+  do {
+    memset(info, 0, (fs->pc + 1) * sizeof(int));
+    marktargets(fs, info);
+    foldcompares(fs, info);
+    threadjumps(fs, info);
+    marktargets(fs, info);
+    removemoves(fs, info);
+    removeunreachable(fs, info);
+  } while (compact(fs, info) && ++round < 4);
+  luaM_freearray(L, info, size);
+}
+
+/* }====================================================== */
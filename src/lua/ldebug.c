@@ -447,6 +447,7 @@ static const char *getobjname (Proto *p, int lastpc, int reg,
         break;
       }
       case OP_GETTABUP:
+      case OP_GETTABUPTAB:
       case OP_GETTABLE: {
         int k = GETARG_C(i);  /* key index */
         int t = GETARG_B(i);  /* table index */
@@ -494,11 +495,12 @@ static const char *funcnamefromcode (lua_State *L, CallInfo *ci,
   Proto *p = ci_func(ci)->p;  /* calling function */
   int pc = currentpc(ci);  /* calling instruction index */
   Instruction i = p->code[pc];  /* calling instruction */
+  OpCode op = genericop(GET_OPCODE(i));  /* (may have been quickened) */
   if (ci->callstatus & CIST_HOOKED) {  /* was it called inside a hook? */
     *name = "?";
     return "hook";
   }
-  switch (GET_OPCODE(i)) {
+  switch (op) {
     case OP_CALL:
     case OP_TAILCALL:
       return getobjname(p, pc, GETARG_A(i), name);  /* get function name */
@@ -507,7 +509,8 @@ static const char *funcnamefromcode (lua_State *L, CallInfo *ci,
        return "for iterator";
     }
     /* other instructions can do calls through metamethods */
-    case OP_SELF: case OP_GETTABUP: case OP_GETTABLE:
+    case OP_SELF: case OP_GETTABUP: case OP_GETTABUPTAB:
+    case OP_GETTABLE:
       tm = TM_INDEX;
       break;
     case OP_SETTABUP: case OP_SETTABLE:
@@ -516,10 +519,11 @@ static const char *funcnamefromcode (lua_State *L, CallInfo *ci,
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
     case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND:
     case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR: {
-      int offset = cast_int(GET_OPCODE(i)) - cast_int(OP_ADD);  /* ORDER OP */
+      int offset = cast_int(op) - cast_int(OP_ADD);  /* ORDER OP */
       tm = cast(TMS, offset + cast_int(TM_ADD));  /* ORDER TM */
       break;
     }
+    case OP_ADDFORLOOP: tm = TM_ADD; break;
     case OP_UNM: tm = TM_UNM; break;
     case OP_BNOT: tm = TM_BNOT; break;
     case OP_LEN: tm = TM_LEN; break;
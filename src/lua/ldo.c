@@ -218,22 +218,31 @@ static int stackinuse (lua_State *L) {
 }
 
 
+/*
+** A stack is only shrunk when it is more than twice its good size, and
+** then only by half, so that a thread that keeps going deep and coming
+** back does not reallocate its stack around every collection. It never
+** gets smaller than the size reserved with 'lua_reservestack'.
+*/
 void luaD_shrinkstack (lua_State *L) {
   int inuse = stackinuse(L);
   int goodsize = inuse + (inuse / 8) + 2*EXTRA_STACK;
   if (goodsize > LUAI_MAXSTACK)
     goodsize = LUAI_MAXSTACK;  /* respect stack limit */
-  if (L->stacksize > LUAI_MAXSTACK)  /* had been handling stack overflow? */
+  if (goodsize < L->stackreserve)
+    goodsize = L->stackreserve;
+  if (L->stacksize > LUAI_MAXSTACK) {  /* had been handling stack overflow? */
     luaE_freeCI(L);  /* free all CIs (list grew because of an error) */
-  else
+    if (inuse <= (LUAI_MAXSTACK - EXTRA_STACK))  /* overflow is over? */
+      luaD_reallocstack(L, goodsize);
+  }
+  else {
     luaE_shrinkCI(L);  /* shrink list */
-  /* if thread is currently not handling a stack overflow and its
-     good size is smaller than current size, shrink its stack */
-  if (inuse <= (LUAI_MAXSTACK - EXTRA_STACK) &&
-      goodsize < L->stacksize)
-    luaD_reallocstack(L, goodsize);
-  else  /* don't change stack */
-    condmovestack(L,{},{});  /* (change only for debugging) */
+    if (2 * goodsize <= L->stacksize)
+      luaD_reallocstack(L, L->stacksize / 2);
+    else  /* don't change stack */
+      condmovestack(L,{},{});  /* (change only for debugging) */
+  }
 }
 
 
@@ -368,6 +377,25 @@ static int moveresults (lua_State *L, const TValue *firstResult, StkId res,
 }
 
 
+/*
+** Per-function call statistics (see 'lua_callstats'): add a finished
+** call to its function's times and to the time its caller spent in
+** called Lua functions. C functions only pass on the time of the Lua
+** functions they called, so their own time counts as their caller's.
+*/
+void luaD_endcall (CallInfo *ci) {
+  lu_ticks dt = ci->tchild;
+  if (isLua(ci)) {
+    Proto *p = clLvalue(ci->func)->p;
+    dt = luai_ticks() - ci->tstart;
+    p->totaltime += cast_num(dt);
+    p->selftime += cast_num(dt - ci->tchild);
+  }
+  ci->previous->tchild += dt;
+  ci->callstatus &= ~CIST_TIMED;
+}
+
+
 /*
 ** Finishes a function call: calls hook if necessary, removes CallInfo,
 ** moves current number of results to proper place; returns 0 iff call
@@ -376,6 +404,8 @@ static int moveresults (lua_State *L, const TValue *firstResult, StkId res,
 int luaD_poscall (lua_State *L, CallInfo *ci, StkId firstResult, int nres) {
   StkId res;
   int wanted = ci->nresults;
+  if (ci->callstatus & CIST_TIMED)
+    luaD_endcall(ci);
   if (L->hookmask & (LUA_MASKRET | LUA_MASKLINE)) {
     if (L->hookmask & LUA_MASKRET) {
       ptrdiff_t fr = savestack(L, firstResult);  /* hook may change stack */
@@ -428,6 +458,10 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
       ci->top = L->top + LUA_MINSTACK;
       lua_assert(ci->top <= L->stack_last);
       ci->callstatus = 0;
+      if (G(L)->callstats) {
+        ci->callstatus = CIST_TIMED;
+        ci->tchild = 0;
+      }
       if (L->hookmask & LUA_MASKCALL)
         luaD_hook(L, LUA_HOOKCALL, -1);
       lua_unlock(L);
@@ -458,6 +492,12 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
       lua_assert(ci->top <= L->stack_last);
       ci->u.l.savedpc = p->code;  /* starting point */
       ci->callstatus = CIST_LUA;
+      if (G(L)->callstats) {
+        p->calls++;
+        ci->callstatus |= CIST_TIMED;
+        ci->tchild = 0;
+        ci->tstart = luai_ticks();
+      }
       if (L->hookmask & LUA_MASKCALL)
         callhook(L, ci);
       return 0;
@@ -754,6 +794,10 @@ struct SParser {  /* data to 'f_parser' */
 };
 
 
+/*
+** Besides 'b' and 't', a load mode may contain 'o' to have the code
+** generated from text optimized (see 'luaK_optimize').
+*/
 static void checkmode (lua_State *L, const char *mode, const char *x) {
   if (mode && strchr(mode, x[0]) == NULL) {
     luaO_pushfstring(L,
@@ -773,7 +817,8 @@ static void f_parser (lua_State *L, void *ud) {
   }
   else {
     checkmode(L, p->mode, "text");
-    cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
+    cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c,
+                     p->mode != NULL && strchr(p->mode, 'o') != NULL);
   }
   lua_assert(cl->nupvalues == cl->p->sizeupvalues);
   luaF_initupvals(L, cl);
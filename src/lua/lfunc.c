@@ -16,6 +16,7 @@
 
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -104,7 +105,12 @@ Proto *luaF_newproto (lua_State *L) {
   f->p = NULL;
   f->sizep = 0;
   f->code = NULL;
+  f->hints = NULL;
   f->cache = NULL;
+  f->jit = NULL;
+  f->jitcount = JITTHRESHOLD;
+  f->calls = 0;
+  f->selftime = f->totaltime = 0;
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
@@ -122,13 +128,27 @@ Proto *luaF_newproto (lua_State *L) {
 }
 
 
+/*
+** Creates the inline caches of a prototype, once its code is complete
+*/
+void luaF_newhints (lua_State *L, Proto *f) {
+  int i;
+  f->hints = luaM_newvector(L, f->sizecode, unsigned int);
+  for (i = 0; i < f->sizecode; i++)
+    f->hints[i] = 0;
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->code, f->sizecode);
+  luaM_freearray(L, f->hints, f->sizecode);  /* (may be NULL) */
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
   luaM_freearray(L, f->lineinfo, f->sizelineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
+  if (f->jit != NULL)
+    luaJ_free(L, f);
   luaM_free(L, f);
 }
 
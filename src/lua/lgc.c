@@ -45,6 +45,13 @@
 #define GCFINALIZECOST	GCSWEEPCOST
 
 
+/*
+** number of string table buckets split (or merged) by a pending resize
+** in each GC step
+*/
+#define GCSTRRESIZE	100
+
+
 /*
 ** macro to adjust 'stepmul': 'stepmul' is actually used like
 ** 'stepmul / STEPMULADJ' (value chosen by tests)
@@ -80,6 +87,21 @@
   lua_longassert(!iscollectable(obj) || righttt(obj))
 
 
+/*
+** add a pause of 'dt' nanoseconds to the power-of-two (in
+** microseconds) histogram 'hist'
+*/
+static void addpause (size_t *hist, double dt) {
+  double us = dt / 1000;
+  int b = 0;
+  while (us >= 1 && b < LUA_GCSTATBUCKETS - 1) {
+    us /= 2;
+    b++;
+  }
+  hist[b]++;
+}
+
+
 #define markvalue(g,o) { checkconsistency(o); \
   if (valiswhite(o)) reallymarkobject(g,gcvalue(o)); }
 
@@ -107,6 +129,26 @@ static void reallymarkobject (global_State *g, GCObject *o);
 #define gnodelast(h)	gnode(h, cast(size_t, sizenode(h)))
 
 
+/*
+** Get the bounds of the 'part'-th node vector of table 'h': its hash
+** part and, while it grows incrementally, its old hash part. Returns
+** 0 when there are no more parts.
+*/
+static int nodepart (Table *h, int part, Node **n, Node **limit) {
+  if (part == 0) {
+    *n = gnode(h, 0);
+    *limit = gnodelast(h);
+    return 1;
+  }
+  else if (part == 1 && isrehashing(h)) {
+    *n = h->u.oldnode;
+    *limit = *n + twoto(h->oldlsizenode);
+    return 1;
+  }
+  else return 0;
+}
+
+
 /*
 ** link collectable object 'o' into list pointed by 'p'
 */
@@ -243,7 +285,7 @@ static void reallymarkobject (global_State *g, GCObject *o) {
     }
     case LUA_TLNGSTR: {
       gray2black(o);
-      g->GCmemtrav += sizelstring(gco2ts(o)->u.lnglen);
+      g->GCmemtrav += sizelngstr(gco2ts(o));
       break;
     }
     case LUA_TUSERDATA: {
@@ -359,11 +401,13 @@ static void restartcollection (global_State *g) {
 ** put it in 'weak' list, to be cleared.
 */
 static void traverseweakvalue (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
-  /* if there is array part, assume it may have white values (it is not
-     worth traversing it now just to check) */
-  int hasclears = (h->sizearray > 0);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
+  Node *n, *limit;
+  int part;
+  /* if there is array part or slots, assume they may have white values
+     (it is not worth traversing them now just to check) */
+  int hasclears = (h->sizearray > 0 || h->sizeslots > 0);
+  for (part = 0; nodepart(h, part, &n, &limit); part++)
+  for (; n < limit; n++) {  /* traverse hash part */
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
@@ -395,8 +439,9 @@ static int traverseephemeron (global_State *g, Table *h) {
   int marked = 0;  /* true if an object is marked in this traversal */
   int hasclears = 0;  /* true if table has white keys */
   int hasww = 0;  /* true if table has entry "white-key -> white-value" */
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
   unsigned int i;
+  int part;
   /* traverse array part */
   for (i = 0; i < h->sizearray; i++) {
     if (valiswhite(&h->array[i])) {
@@ -404,8 +449,16 @@ static int traverseephemeron (global_State *g, Table *h) {
       reallymarkobject(g, gcvalue(&h->array[i]));
     }
   }
+  /* traverse slots (their keys are strings, so never weak) */
+  for (i = 0; i < h->sizeslots; i++) {
+    if (valiswhite(&h->u.slots[i])) {
+      marked = 1;
+      reallymarkobject(g, gcvalue(&h->u.slots[i]));
+    }
+  }
   /* traverse hash part */
-  for (n = gnode(h, 0); n < limit; n++) {
+  for (part = 0; nodepart(h, part, &n, &limit); part++)
+  for (; n < limit; n++) {
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
@@ -431,11 +484,15 @@ static int traverseephemeron (global_State *g, Table *h) {
 
 
 static void traversestrongtable (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
   unsigned int i;
+  int part;
   for (i = 0; i < h->sizearray; i++)  /* traverse array part */
     markvalue(g, &h->array[i]);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
+  for (i = 0; i < h->sizeslots; i++)  /* traverse slots */
+    markvalue(g, &h->u.slots[i]);
+  for (part = 0; nodepart(h, part, &n, &limit); part++)
+  for (; n < limit; n++) {  /* traverse hash part */
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
@@ -448,13 +505,32 @@ static void traversestrongtable (global_State *g, Table *h) {
 }
 
 
+/*
+** Whether weak mode 'mode' has option 'c', as 'strchr' tells. (The
+** mode may share a block with a longer string, so it is not always
+** followed by a '\0'.)
+*/
+static int hasmode (const TValue *mode, int c) {
+  const char *s = svalue(mode);
+  size_t l = vslen(mode);
+  const char *e = (const char *)memchr(s, '\0', l);
+  if (e != NULL) l = cast(size_t, e - s);
+  return (memchr(s, c, l) != NULL);
+}
+
+
 static lu_mem traversetable (global_State *g, Table *h) {
-  const char *weakkey, *weakvalue;
+  int weakkey, weakvalue;
   const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
   markobjectN(g, h->metatable);
+  if (h->shape != NULL) {  /* mark keys of slots (strings are never weak) */
+    int i;
+    for (i = 0; i < h->shape->nkeys; i++)
+      markobject(g, h->shape->keys[i]);
+  }
   if (mode && ttisstring(mode) &&  /* is there a weak mode? */
-      ((weakkey = strchr(svalue(mode), 'k')),
-       (weakvalue = strchr(svalue(mode), 'v')),
+      ((weakkey = hasmode(mode, 'k')),
+       (weakvalue = hasmode(mode, 'v')),
        (weakkey || weakvalue))) {  /* is really weak? */
     black2gray(h);  /* keep table gray */
     if (!weakkey)  /* strong keys? */
@@ -466,8 +542,9 @@ static lu_mem traversetable (global_State *g, Table *h) {
   }
   else  /* not weak */
     traversestrongtable(g, h);
-  return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                         sizeof(Node) * cast(size_t, allocsizenode(h));
+  return sizeof(Table) + sizeof(TValue) * (h->sizearray + h->sizeslots) +
+                         sizeof(Node) * cast(size_t, allocsizenode(h) +
+                           (isrehashing(h) ? twoto(h->oldlsizenode) : 0));
 }
 
 
@@ -490,6 +567,7 @@ static int traverseproto (global_State *g, Proto *f) {
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
   return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+                         sizeof(unsigned int) * (f->hints ? f->sizecode : 0) +
                          sizeof(Proto *) * f->sizep +
                          sizeof(TValue) * f->sizek +
                          sizeof(int) * f->sizelineinfo +
@@ -639,8 +717,10 @@ static void convergeephemerons (global_State *g) {
 static void clearkeys (global_State *g, GCObject *l, GCObject *f) {
   for (; l != f; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
-    for (n = gnode(h, 0); n < limit; n++) {
+    Node *n, *limit;
+    int part;
+    for (part = 0; nodepart(h, part, &n, &limit); part++)
+    for (; n < limit; n++) {
       if (!ttisnil(gval(n)) && (iscleared(g, gkey(n)))) {
         setnilvalue(gval(n));  /* remove value ... */
       }
@@ -658,14 +738,21 @@ static void clearkeys (global_State *g, GCObject *l, GCObject *f) {
 static void clearvalues (global_State *g, GCObject *l, GCObject *f) {
   for (; l != f; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
+    Node *n, *limit;
     unsigned int i;
+    int part;
     for (i = 0; i < h->sizearray; i++) {
       TValue *o = &h->array[i];
       if (iscleared(g, o))  /* value was collected? */
         setnilvalue(o);  /* remove value */
     }
-    for (n = gnode(h, 0); n < limit; n++) {
+    for (i = 0; i < h->sizeslots; i++) {
+      TValue *o = &h->u.slots[i];
+      if (iscleared(g, o))  /* value was collected? */
+        setnilvalue(o);  /* remove value */
+    }
+    for (part = 0; nodepart(h, part, &n, &limit); part++)
+    for (; n < limit; n++) {
       if (!ttisnil(gval(n)) && iscleared(g, gval(n))) {
         setnilvalue(gval(n));  /* remove value ... */
         removeentry(n);  /* and remove entry from table */
@@ -713,7 +800,7 @@ static void freeobj (lua_State *L, GCObject *o) {
       luaM_freemem(L, o, sizelstring(gco2ts(o)->shrlen));
       break;
     case LUA_TLNGSTR: {
-      luaM_freemem(L, o, sizelstring(gco2ts(o)->u.lnglen));
+      luaS_freelngstr(L, gco2ts(o));
       break;
     }
     default: lua_assert(0);
@@ -779,7 +866,7 @@ static void checkSizes (lua_State *L, global_State *g) {
   if (g->gckind != KGC_EMERGENCY) {
     l_mem olddebt = g->GCdebt;
     if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
-      luaS_resize(L, g->strt.size / 2);  /* shrink it a little */
+      luaS_resize(L, g->strt.size / 2);  /* shrink it (ends a pending resize) */
     g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
   }
 }
@@ -808,6 +895,7 @@ static void GCTM (lua_State *L, int propagateerrors) {
   global_State *g = G(L);
   const TValue *tm;
   TValue v;
+  double t0 = luaE_nanotime();
   setgcovalue(L, &v, udata2finalize(g));
   tm = luaT_gettmbyobj(L, &v, TM_GC);
   if (tm != NULL && ttisfunction(tm)) {  /* is there a finalizer? */
@@ -824,10 +912,12 @@ static void GCTM (lua_State *L, int propagateerrors) {
     L->ci->callstatus &= ~CIST_FIN;  /* not running a finalizer anymore */
     L->allowhook = oldah;  /* restore hooks */
     g->gcrunning = running;  /* restore state */
+    g->gcstats.finalizers++;
+    g->gcstats.fintime += luaE_nanotime() - t0;
     if (status != LUA_OK && propagateerrors) {  /* error while running __gc? */
       if (status == LUA_ERRRUN) {  /* is there an error object? */
         const char *msg = (ttisstring(L->top - 1))
-                            ? svalue(L->top - 1)
+                            ? luaS_tocstr(L, tsvalue(L->top - 1))
                             : "no message";
         luaO_pushfstring(L, "error in __gc metamethod (%s)", msg);
         status = LUA_ERRGCMM;  /* error in __gc metamethod */
@@ -1032,6 +1122,7 @@ static lu_mem sweepstep (lua_State *L, global_State *g,
     l_mem olddebt = g->GCdebt;
     g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
     g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
+    g->gcstats.bytesfreed += olddebt - g->GCdebt;
     if (g->sweepgc)  /* is there still something to sweep? */
       return (GCSWEEPMAX * GCSWEEPCOST);
   }
@@ -1061,10 +1152,17 @@ static lu_mem singlestep (lua_State *L) {
     }
     case GCSatomic: {
       lu_mem work;
+      double t0 = luaE_nanotime();
+      double dt;
       propagateall(g);  /* make sure gray list is empty */
       work = atomic(L);  /* work is what was traversed by 'atomic' */
       entersweep(L);
       g->GCestimate = gettotalbytes(g);  /* first estimate */;
+      dt = luaE_nanotime() - t0;
+      g->gcstats.atomics++;
+      g->gcstats.atomictime += dt;
+      if (dt > g->gcstats.maxatomic) g->gcstats.maxatomic = dt;
+      addpause(g->gcstats.atomichist, dt);
       return work;
     }
     case GCSswpallgc: {  /* sweep "regular" objects */
@@ -1089,6 +1187,7 @@ static lu_mem singlestep (lua_State *L) {
       }
       else {  /* emergency mode or no more finalizers */
         g->gcstate = GCSpause;  /* finish collection */
+        g->gcstats.cycles++;
         return 0;
       }
     }
@@ -1123,27 +1222,97 @@ static l_mem getdebt (global_State *g) {
   }
 }
 
+/*
+** In idle mode ('gcidlelimit' > 0), allocations only move their debt
+** to 'GCdeferred', to be paid later by 'luaC_idlestep' when the host
+** has nothing else to do. When the deferred debt exceeds 'gcidlelimit',
+** a regular step pays only the excess (plus a step), so that a script
+** never stops to pay all of it. Returns true if the debt was deferred.
+*/
+static int deferdebt (global_State *g) {
+  l_mem debt = g->GCdebt + g->GCdeferred;  /* whole debt */
+  if (debt < g->gcidlelimit) {
+    g->GCdeferred = debt + GCSTEPSIZE;
+    luaE_setdebt(g, -GCSTEPSIZE);  /* check again after a while */
+    return 1;
+  }
+  else {  /* too much garbage piled up; pay some of it now */
+    l_mem pay = debt - g->gcidlelimit + GCSTEPSIZE;
+    if (pay > debt) pay = debt;
+    g->GCdeferred = debt - pay;  /* keep the rest for idle time */
+    luaE_setdebt(g, pay);
+    return 0;
+  }
+}
+
+
 /*
 ** performs a basic GC step when collector is running
 */
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
-  l_mem debt = getdebt(g);  /* GC deficit (be paid now) */
+  l_mem debt;
+  double t0, dt;
   if (!g->gcrunning) {  /* not running? */
     luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
     return;
   }
+  if (g->gcidlelimit > 0 && deferdebt(g))
+    return;
+  debt = getdebt(g);  /* GC deficit (be paid now) */
+  t0 = luaE_nanotime();
+  luaS_resizestep(L, GCSTRRESIZE);  /* help a pending string table resize */
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
   } while (debt > -GCSTEPSIZE && g->gcstate != GCSpause);
-  if (g->gcstate == GCSpause)
+  if (g->gcstate == GCSpause) {
     setpause(g);  /* pause until next cycle */
+    g->GCdeferred = 0;  /* a finished cycle leaves no debt */
+  }
   else {
     debt = (debt / g->gcstepmul) * STEPMULADJ;  /* convert 'work units' to Kb */
     luaE_setdebt(g, debt);
     runafewfinalizers(L);
   }
+  dt = luaE_nanotime() - t0;
+  g->gcstats.steps++;
+  g->gcstats.steptime += dt;
+  if (dt > g->gcstats.maxstep) g->gcstats.maxstep = dt;
+  addpause(g->gcstats.stephist, dt);
+}
+
+
+/*
+** pays the debt (deferred or not) for at most 'budget' nanoseconds;
+** meant to be called by the host while it is idle. Returns true if
+** there is nothing left to do: no debt, or a stopped collector.
+*/
+int luaC_idlestep (lua_State *L, double budget) {
+  global_State *g = G(L);
+  double t0 = luaE_nanotime();
+  double dt;
+  l_mem debt;
+  luaE_setdebt(g, g->GCdebt + g->GCdeferred);  /* take back all debt */
+  g->GCdeferred = 0;
+  debt = getdebt(g);
+  if (!g->gcrunning || debt == 0)
+    return 1;
+  do {  /* repeat until pause, enough "credit", or out of time */
+    lu_mem work = singlestep(L);
+    debt -= work;
+    dt = luaE_nanotime() - t0;
+  } while (debt > -GCSTEPSIZE && g->gcstate != GCSpause && dt < budget);
+  if (g->gcstate == GCSpause)
+    setpause(g);  /* pause until next cycle */
+  else {
+    debt = (debt / g->gcstepmul) * STEPMULADJ;  /* convert 'work units' to Kb */
+    luaE_setdebt(g, debt);  /* what is left is deferred by next 'luaC_step' */
+    runafewfinalizers(L);
+  }
+  g->gcstats.idlesteps++;
+  g->gcstats.idletime += luaE_nanotime() - t0;
+  return (g->GCdebt <= 0);
 }
 
 
@@ -1158,6 +1327,7 @@ void luaC_step (lua_State *L) {
 */
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
+  double t0 = luaE_nanotime();
   lua_assert(g->gckind == KGC_NORMAL);
   if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
   if (keepinvariant(g)) {  /* black objects? */
@@ -1172,6 +1342,9 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
   g->gckind = KGC_NORMAL;
   setpause(g);
+  g->GCdeferred = 0;  /* all debt was paid */
+  g->gcstats.fullcycles++;
+  g->gcstats.fulltime += luaE_nanotime() - t0;
 }
 
 /* }====================================================== */
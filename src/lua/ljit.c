@@ -0,0 +1,842 @@
+/*
+** $Id: ljit.c $
+** Baseline compiler from Lua bytecode to x86-64 machine code
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE		/* for MAP_ANONYMOUS */
+#endif
+
+#include "lprefix.h"
+
+#include "lua.h"
+
+#include "ljit.h"
+
+#if defined(LUA_USE_JIT)
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lopcodes.h"
+#include "ltable.h"
+#include "lvm.h"
+
+
+#if LUA_FLOAT_TYPE != LUA_FLOAT_DOUBLE || LUA_INT_TYPE != LUA_INT_LONGLONG
+#error "LUA_USE_JIT needs 64-bit integers and double floats"
+#endif
+
+
+/*
+** Each instruction of a function is translated on its own, from a
+** fixed template, into code that works directly on the Lua stack.
+** Only common cases are compiled: integer and float arithmetic,
+** comparisons, jumps and loops, moves and constants, and table
+** accesses that need no metamethod. Anything else (calls, metamethods,
+** allocation, unexpected types) leaves the machine code with 'savedpc'
+** pointing to that instruction, and the interpreter goes on from
+** there; it comes back into the machine code at the start of frames
+** and at backward jumps (see 'jitenter' in lvm.c). So compiled code
+** never allocates, calls Lua, raises errors or moves the stack.
+**
+** While compiled code runs, rbx holds 'base', r13 the lua_State and
+** r14 the CallInfo.
+*/
+
+
+typedef struct JitCode {
+  lu_byte *mcode;  /* machine code; its entry routine is at offset 0 */
+  size_t size;  /* size of the mapping of 'mcode' */
+  unsigned int entry[1];  /* code offset of each instruction (0: none) */
+} JitCode;
+
+#define sizejitcode(n)	(offsetof(JitCode, entry) + \
+                         cast(size_t, n) * sizeof(unsigned int))
+
+
+typedef void (*JitFunction) (lua_State *L, CallInfo *ci,
+                             const lu_byte *target);
+
+
+/* maximum size of the code of one instruction and of an exit stub */
+#define MAXTEMPLATE	512
+#define EXITSIZE	32
+
+/* maximum number of jumps to patch in one instruction */
+#define MAXFIXUPS	16
+
+
+/* a jump to be patched once its target is known */
+typedef struct Fixup {
+  size_t pos;  /* position of the jump's 32-bit displacement */
+  int pc;  /* target instruction */
+  int toexit;  /* true if the target is the exit stub of 'pc' */
+} Fixup;
+
+
+typedef struct JitState {
+  Proto *p;
+  lu_byte *code;  /* code being generated */
+  size_t n;  /* bytes of code generated */
+  unsigned int *pos;  /* position of the code of each instruction */
+  unsigned int *exitpos;  /* position of the exit stub of each one */
+  Fixup *fix;  /* pending jumps */
+  int nfix;
+  size_t epilogue;  /* position of the return sequence */
+  int pc;  /* instruction being compiled */
+} JitState;
+
+
+/*
+** {======================================================
+** x86-64 encoding
+** =======================================================
+*/
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R13 = 13, R14 };
+
+/* condition codes (-1 means an unconditional jump) */
+#define CC_ALWAYS	(-1)
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_NS	0x9
+#define CC_P	0xa
+#define CC_L	0xc
+#define CC_LE	0xe
+#define CC_G	0xf
+
+/* opcodes (two-byte ones include the 0x0F escape) */
+#define X_ADD	0x03
+#define X_SUB	0x2b
+#define X_CMP	0x3b
+#define X_MOVST	0x89
+#define X_MOVLD	0x8b
+#define X_LEA	0x8d
+#define X_IMUL	0x0faf
+#define X_MOVSDLD	0x0f10
+#define X_MOVSDST	0x0f11
+#define X_CVTSI2SD	0x0f2a
+#define X_UCOMISD	0x0f2e
+#define X_ADDSD	0x0f58
+#define X_MULSD	0x0f59
+#define X_SUBSD	0x0f5c
+#define X_DIVSD	0x0f5e
+
+#define P_F2	0xf2	/* prefix for scalar double operations */
+#define P_66	0x66	/* prefix for 'ucomisd' */
+
+
+static void emitb (JitState *J, int b) {
+  J->code[J->n++] = cast_byte(b);
+}
+
+
+static void emitd (JitState *J, int d) {
+  memcpy(J->code + J->n, &d, sizeof(d));
+  J->n += sizeof(d);
+}
+
+
+/* REX prefix, if needed, for a 64-bit operation or high registers */
+static void rex (JitState *J, int w, int reg, int rm) {
+  int r = (w ? 8 : 0) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+  if (r != 0)
+    emitb(J, 0x40 | r);
+}
+
+
+static void opcode (JitState *J, int pfx, int w, int op, int reg, int rm) {
+  if (pfx)
+    emitb(J, pfx);
+  rex(J, w, reg, rm);
+  if (op > 0xff)
+    emitb(J, op >> 8);
+  emitb(J, op & 0xff);
+}
+
+
+/* instruction 'op' with operands 'reg' and [rm + disp] */
+static void opm (JitState *J, int pfx, int w, int op, int reg, int rm,
+                 int disp) {
+  opcode(J, pfx, w, op, reg, rm);
+  emitb(J, 0x80 | ((reg & 7) << 3) | (rm & 7));  /* [rm + disp32] */
+  if ((rm & 7) == RSP)
+    emitb(J, 0x24);  /* SIB byte for rsp/r12 */
+  emitd(J, disp);
+}
+
+
+/* instruction 'op' with register operands 'reg' and 'rm' */
+static void opr (JitState *J, int pfx, int w, int op, int reg, int rm) {
+  opcode(J, pfx, w, op, reg, rm);
+  emitb(J, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+/* cmp dword [rm + disp], imm */
+static void cmpmi (JitState *J, int rm, int disp, int imm) {
+  opm(J, 0, 0, 0x81, 7, rm, disp);
+  emitd(J, imm);
+}
+
+
+/* mov dword [rm + disp], imm */
+static void movmi (JitState *J, int rm, int disp, int imm) {
+  opm(J, 0, 0, 0xc7, 0, rm, disp);
+  emitd(J, imm);
+}
+
+
+/* mov reg, imm64 */
+static void movri (JitState *J, int reg, const void *imm) {
+  rex(J, 1, 0, reg);
+  emitb(J, 0xb8 | (reg & 7));
+  memcpy(J->code + J->n, &imm, sizeof(imm));
+  J->n += sizeof(imm);
+}
+
+
+/* call to C function 'f' */
+static void callf (JitState *J, void (*f) (void)) {
+  rex(J, 1, 0, RAX);
+  emitb(J, 0xb8);  /* mov rax, f */
+  memcpy(J->code + J->n, &f, sizeof(f));
+  J->n += sizeof(f);
+  emitb(J, 0xff);  /* call rax */
+  emitb(J, 0xd0);
+}
+
+
+/* emits a jump; returns the position of its displacement */
+static size_t jump (JitState *J, int cc) {
+  if (cc == CC_ALWAYS)
+    emitb(J, 0xe9);
+  else {
+    emitb(J, 0x0f);
+    emitb(J, 0x80 | cc);
+  }
+  emitd(J, 0);
+  return J->n - 4;
+}
+
+
+static void patch (JitState *J, size_t pos, size_t target) {
+  int d = cast_int(cast(ptrdiff_t, target) - cast(ptrdiff_t, pos + 4));
+  memcpy(J->code + pos, &d, sizeof(d));
+}
+
+
+/* makes the jump at 'pos' go to the current position */
+static void here (JitState *J, size_t pos) {
+  patch(J, pos, J->n);
+}
+
+
+static void addfix (JitState *J, size_t pos, int pc, int toexit) {
+  Fixup *f = &J->fix[J->nfix++];
+  f->pos = pos;
+  f->pc = pc;
+  f->toexit = toexit;
+}
+
+
+/* jump to the code of instruction 'pc' */
+static void jumpto (JitState *J, int cc, int pc) {
+  addfix(J, jump(J, cc), pc, 0);
+}
+
+
+/* jump out of compiled code, resuming the interpreter at 'pc' */
+static void exitto (JitState *J, int cc, int pc) {
+  addfix(J, jump(J, cc), pc, 1);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Templates
+** =======================================================
+*/
+
+#define VAL	cast_int(offsetof(TValue, value_))
+#define TT	cast_int(offsetof(TValue, tt_))
+
+/* displacement of register 'r' from 'base' */
+#define REG(r)	(cast_int(sizeof(TValue)) * (r))
+
+
+/* exit stub: resume the interpreter at instruction 'pc' */
+static void emitexit (JitState *J, int pc) {
+  movri(J, RAX, J->p->code + pc);
+  opm(J, 0, 1, X_MOVST, RAX, R14, cast_int(offsetof(CallInfo, u.l.savedpc)));
+  patch(J, jump(J, CC_ALWAYS), J->epilogue);
+}
+
+
+/* loads into 'reg' the address of RK(x) */
+static void rkaddr (JitState *J, int reg, int x) {
+  if (ISK(x))
+    movri(J, reg, J->p->k + INDEXK(x));
+  else
+    opm(J, 0, 1, X_LEA, reg, RBX, REG(x));
+}
+
+
+/* loads into 'reg' the address of the value of upvalue 'n' */
+static void upvaladdr (JitState *J, int reg, int n) {
+  opm(J, 0, 1, X_MOVLD, reg, R14, cast_int(offsetof(CallInfo, func)));
+  opm(J, 0, 1, X_MOVLD, reg, reg, VAL);  /* closure */
+  opm(J, 0, 1, X_MOVLD, reg, reg,
+      cast_int(offsetof(LClosure, upvals) + n * sizeof(UpVal *)));
+  opm(J, 0, 1, X_MOVLD, reg, reg, cast_int(offsetof(UpVal, v)));
+}
+
+
+/* copies the value at [src + sd] to [dst + dd] (through rcx and rdx) */
+static void copytv (JitState *J, int dst, int dd, int src, int sd) {
+  opm(J, 0, 1, X_MOVLD, RCX, src, sd);
+  opm(J, 0, 1, X_MOVLD, RDX, src, sd + 8);
+  opm(J, 0, 1, X_MOVST, RCX, dst, dd);
+  opm(J, 0, 1, X_MOVST, RDX, dst, dd + 8);
+}
+
+
+/*
+** Tests whether R at displacement 'd' is false or nil: the code falls
+** through when it is true, and takes one of the jumps 'f' otherwise.
+*/
+static void testfalse (JitState *J, int d, size_t f[2]) {
+  size_t istrue;
+  cmpmi(J, RBX, d + TT, LUA_TNIL);
+  f[0] = jump(J, CC_E);
+  cmpmi(J, RBX, d + TT, LUA_TBOOLEAN);
+  istrue = jump(J, CC_NE);
+  cmpmi(J, RBX, d + VAL, 0);
+  f[1] = jump(J, CC_E);
+  here(J, istrue);
+}
+
+
+/* backward jump to 'pc', leaving compiled code if a hook was set */
+static void backedge (JitState *J, int pc) {
+  cmpmi(J, R13, cast_int(offsetof(lua_State, hookmask)), 0);
+  exitto(J, CC_NE, pc);
+  jumpto(J, CC_ALWAYS, pc);
+}
+
+
+/* loads the number at [reg] as a float into xmm 'x' */
+static void loadnum (JitState *J, int x, int reg) {
+  size_t notflt, done;
+  cmpmi(J, reg, TT, LUA_TNUMFLT);
+  notflt = jump(J, CC_NE);
+  opm(J, P_F2, 0, X_MOVSDLD, x, reg, VAL);
+  done = jump(J, CC_ALWAYS);
+  here(J, notflt);
+  cmpmi(J, reg, TT, LUA_TNUMINT);
+  exitto(J, CC_NE, J->pc);
+  opm(J, P_F2, 1, X_CVTSI2SD, x, reg, VAL);
+  here(J, done);
+}
+
+
+/* R(A) := RK(B) op RK(C); 'iop' is 0 for operations done on floats */
+static void arith (JitState *J, Instruction i, int iop, int fop) {
+  int ra = REG(GETARG_A(i));
+  size_t notint[2], done = 0;
+  rkaddr(J, RSI, GETARG_B(i));
+  rkaddr(J, RDI, GETARG_C(i));
+  if (iop) {
+    cmpmi(J, RSI, TT, LUA_TNUMINT);
+    notint[0] = jump(J, CC_NE);
+    cmpmi(J, RDI, TT, LUA_TNUMINT);
+    notint[1] = jump(J, CC_NE);
+    opm(J, 0, 1, X_MOVLD, RAX, RSI, VAL);
+    opm(J, 0, 1, iop, RAX, RDI, VAL);
+    opm(J, 0, 1, X_MOVST, RAX, RBX, ra + VAL);
+    movmi(J, RBX, ra + TT, LUA_TNUMINT);
+    done = jump(J, CC_ALWAYS);
+    here(J, notint[0]);
+    here(J, notint[1]);
+  }
+  loadnum(J, 0, RSI);
+  loadnum(J, 1, RDI);
+  opr(J, P_F2, 0, fop, 0, 1);  /* xmm0 op= xmm1 */
+  opm(J, P_F2, 0, X_MOVSDST, 0, RBX, ra + VAL);
+  movmi(J, RBX, ra + TT, LUA_TNUMFLT);
+  if (iop)
+    here(J, done);
+}
+
+
+/* R(A) := RK(B) % RK(C), for integers (see 'luaV_mod') */
+static void mod (JitState *J, Instruction i) {
+  size_t special, zero, done;
+  rkaddr(J, RSI, GETARG_B(i));
+  rkaddr(J, RDI, GETARG_C(i));
+  cmpmi(J, RSI, TT, LUA_TNUMINT);
+  exitto(J, CC_NE, J->pc);
+  cmpmi(J, RDI, TT, LUA_TNUMINT);
+  exitto(J, CC_NE, J->pc);
+  opm(J, 0, 1, X_MOVLD, RCX, RDI, VAL);
+  opm(J, 0, 1, X_LEA, RAX, RCX, 1);
+  opr(J, 0, 1, 0x81, 7, RAX);  /* cmp rax, 1 */
+  emitd(J, 1);
+  special = jump(J, CC_BE);  /* divisor is 0 or -1? */
+  opm(J, 0, 1, X_MOVLD, RAX, RSI, VAL);
+  emitb(J, 0x48); emitb(J, 0x99);  /* cqo */
+  opr(J, 0, 1, 0xf7, 7, RCX);  /* idiv rcx */
+  opr(J, 0, 1, 0x85, RDX, RDX);  /* test rdx, rdx */
+  zero = jump(J, CC_E);
+  opr(J, 0, 1, X_MOVST, RDX, RAX);  /* mov rax, rdx */
+  opr(J, 0, 1, 0x31, RCX, RAX);  /* xor rax, rcx */
+  done = jump(J, CC_NS);
+  opr(J, 0, 1, 0x01, RCX, RDX);  /* different signs: add rdx, rcx */
+  here(J, done);
+  here(J, zero);
+  done = jump(J, CC_ALWAYS);
+  here(J, special);
+  opr(J, 0, 1, 0x85, RCX, RCX);  /* test rcx, rcx */
+  exitto(J, CC_E, J->pc);  /* let the interpreter raise the error */
+  opr(J, 0, 0, 0x31, RDX, RDX);  /* m % -1 == 0 */
+  here(J, done);
+  opm(J, 0, 1, X_MOVST, RDX, RBX, REG(GETARG_A(i)) + VAL);
+  movmi(J, RBX, REG(GETARG_A(i)) + TT, LUA_TNUMINT);
+}
+
+
+/* R(A) := -R(B) */
+static void unm (JitState *J, Instruction i) {
+  int ra = REG(GETARG_A(i));
+  int rb = REG(GETARG_B(i));
+  size_t notint, done;
+  opm(J, 0, 1, X_MOVLD, RAX, RBX, rb + VAL);
+  cmpmi(J, RBX, rb + TT, LUA_TNUMINT);
+  notint = jump(J, CC_NE);
+  opr(J, 0, 1, 0xf7, 3, RAX);  /* neg rax */
+  opm(J, 0, 1, X_MOVST, RAX, RBX, ra + VAL);
+  movmi(J, RBX, ra + TT, LUA_TNUMINT);
+  done = jump(J, CC_ALWAYS);
+  here(J, notint);
+  cmpmi(J, RBX, rb + TT, LUA_TNUMFLT);
+  exitto(J, CC_NE, J->pc);
+  opr(J, 0, 1, 0x0fba, 7, RAX);  /* btc rax, 63 */
+  emitb(J, 63);
+  opm(J, 0, 1, X_MOVST, RAX, RBX, ra + VAL);
+  movmi(J, RBX, ra + TT, LUA_TNUMFLT);
+  here(J, done);
+}
+
+
+/*
+** if ((RK(B) op RK(C)) ~= A) then pc++: a true comparison goes on to
+** the jump that follows it when A is 1, and skips it otherwise
+*/
+static void compare (JitState *J, Instruction i, OpCode op) {
+  int pc = J->pc;
+  int yes = GETARG_A(i) ? pc + 1 : pc + 2;
+  int no = GETARG_A(i) ? pc + 2 : pc + 1;
+  size_t notint[2], notflt[2];
+  rkaddr(J, RSI, GETARG_B(i));
+  rkaddr(J, RDI, GETARG_C(i));
+  cmpmi(J, RSI, TT, LUA_TNUMINT);
+  notint[0] = jump(J, CC_NE);
+  cmpmi(J, RDI, TT, LUA_TNUMINT);
+  notint[1] = jump(J, CC_NE);
+  opm(J, 0, 1, X_MOVLD, RAX, RSI, VAL);
+  opm(J, 0, 1, X_CMP, RAX, RDI, VAL);
+  jumpto(J, (op == OP_EQ) ? CC_E : (op == OP_LT) ? CC_L : CC_LE, yes);
+  jumpto(J, CC_ALWAYS, no);
+  here(J, notint[0]);
+  here(J, notint[1]);
+  cmpmi(J, RSI, TT, LUA_TNUMFLT);
+  notflt[0] = jump(J, CC_NE);
+  cmpmi(J, RDI, TT, LUA_TNUMFLT);
+  notflt[1] = jump(J, CC_NE);
+  opm(J, P_F2, 0, X_MOVSDLD, 0, RSI, VAL);
+  opm(J, P_F2, 0, X_MOVSDLD, 1, RDI, VAL);
+  if (op == OP_EQ) {
+    opr(J, P_66, 0, X_UCOMISD, 0, 1);
+    jumpto(J, CC_NE, no);
+    jumpto(J, CC_P, no);  /* NaN */
+  }
+  else {  /* 'b > a' and 'b >= a' are false for NaNs */
+    opr(J, P_66, 0, X_UCOMISD, 1, 0);
+    jumpto(J, (op == OP_LT) ? CC_A : CC_AE, yes);
+    jumpto(J, CC_ALWAYS, no);
+  }
+  here(J, notflt[0]);
+  here(J, notflt[1]);
+  if (op == OP_EQ) {  /* nil, booleans and short strings compare raw */
+    size_t notbool;
+    opm(J, 0, 0, X_MOVLD, RAX, RSI, TT);
+    opm(J, 0, 0, X_CMP, RAX, RDI, TT);
+    exitto(J, CC_NE, pc);
+    opr(J, 0, 0, 0x81, 7, RAX);  /* cmp eax, LUA_TNIL */
+    emitd(J, LUA_TNIL);
+    jumpto(J, CC_E, yes);
+    opr(J, 0, 0, 0x81, 7, RAX);  /* cmp eax, LUA_TBOOLEAN */
+    emitd(J, LUA_TBOOLEAN);
+    notbool = jump(J, CC_NE);
+    opm(J, 0, 0, X_MOVLD, RAX, RSI, VAL);
+    opm(J, 0, 0, X_CMP, RAX, RDI, VAL);
+    jumpto(J, CC_E, yes);
+    jumpto(J, CC_ALWAYS, no);
+    here(J, notbool);
+    opr(J, 0, 0, 0x81, 7, RAX);  /* cmp eax, short string */
+    emitd(J, ctb(LUA_TSHRSTR));
+    exitto(J, CC_NE, pc);
+    opm(J, 0, 1, X_MOVLD, RAX, RSI, VAL);
+    opm(J, 0, 1, X_CMP, RAX, RDI, VAL);
+    jumpto(J, CC_E, yes);
+    jumpto(J, CC_ALWAYS, no);
+  }
+  else
+    exitto(J, CC_ALWAYS, pc);
+}
+
+
+/* raw 't[key]' if 't' is a table and it is not nil; NULL otherwise */
+static const TValue *jit_get (const TValue *t, const TValue *key) {
+  const TValue *slot;
+  if (!ttistable(t))
+    return NULL;
+  if (ttisshrstring(key))
+    slot = luaH_getshortstr(hvalue(t), tsvalue(key));
+  else
+    slot = luaH_get(hvalue(t), key);
+  return ttisnil(slot) ? NULL : slot;
+}
+
+
+/* 't[key] = v' if 't' is a table and 't[key]' is not nil */
+static int jit_set (lua_State *L, const TValue *t, const TValue *key,
+                    const TValue *v) {
+  const TValue *slot;
+  return luaV_fastset(L, t, key, slot, luaH_get, v);
+}
+
+
+/* R(A) := UpValue[B][RK(C)] or R(A) := R(B)[RK(C)] */
+static void gettable (JitState *J, Instruction i, int up) {
+  if (up)
+    upvaladdr(J, RDI, GETARG_B(i));
+  else
+    opm(J, 0, 1, X_LEA, RDI, RBX, REG(GETARG_B(i)));
+  rkaddr(J, RSI, GETARG_C(i));
+  callf(J, cast(void (*) (void), jit_get));
+  opr(J, 0, 1, 0x85, RAX, RAX);  /* test rax, rax */
+  exitto(J, CC_E, J->pc);
+  copytv(J, RBX, REG(GETARG_A(i)), RAX, 0);
+}
+
+
+/* UpValue[A][RK(B)] := RK(C) or R(A)[RK(B)] := RK(C) */
+static void settable (JitState *J, Instruction i, int up) {
+  opr(J, 0, 1, X_MOVST, R13, RDI);  /* mov rdi, r13 */
+  if (up)
+    upvaladdr(J, RSI, GETARG_A(i));
+  else
+    opm(J, 0, 1, X_LEA, RSI, RBX, REG(GETARG_A(i)));
+  rkaddr(J, RDX, GETARG_B(i));
+  rkaddr(J, RCX, GETARG_C(i));
+  callf(J, cast(void (*) (void), jit_set));
+  opr(J, 0, 0, 0x85, RAX, RAX);  /* test eax, eax */
+  exitto(J, CC_E, J->pc);
+}
+
+
+/* R(A)+=R(A+2); if R(A) <?= R(A+1) then { pc+=sBx; R(A+3)=R(A) } */
+static void forloop (JitState *J, Instruction i) {
+  int ra = REG(GETARG_A(i));
+  int target = J->pc + 1 + GETARG_sBx(i);
+  size_t down, cont, end[2];
+  cmpmi(J, RBX, ra + TT, LUA_TNUMINT);
+  exitto(J, CC_NE, J->pc);  /* float loop */
+  opm(J, 0, 1, X_MOVLD, RAX, RBX, ra + VAL);
+  opm(J, 0, 1, X_MOVLD, RCX, RBX, ra + REG(2) + VAL);
+  opr(J, 0, 1, 0x01, RCX, RAX);  /* add rax, rcx */
+  opr(J, 0, 1, 0x85, RCX, RCX);  /* test rcx, rcx */
+  down = jump(J, CC_LE);
+  opm(J, 0, 1, X_CMP, RAX, RBX, ra + REG(1) + VAL);
+  end[0] = jump(J, CC_G);
+  cont = jump(J, CC_ALWAYS);
+  here(J, down);
+  opm(J, 0, 1, X_CMP, RAX, RBX, ra + REG(1) + VAL);
+  end[1] = jump(J, CC_L);
+  here(J, cont);
+  opm(J, 0, 1, X_MOVST, RAX, RBX, ra + VAL);
+  opm(J, 0, 1, X_MOVST, RAX, RBX, ra + REG(3) + VAL);
+  movmi(J, RBX, ra + REG(3) + TT, LUA_TNUMINT);
+  backedge(J, target);
+  here(J, end[0]);
+  here(J, end[1]);
+}
+
+
+/*
+** Compiles instruction 'i'. Returns 0 (generating nothing) if it is
+** left to the interpreter. Quickened instructions are compiled as
+** their generic forms and superinstructions as their first part (the
+** second one follows them in the code).
+*/
+static int compileinst (JitState *J, Instruction i) {
+  OpCode op = genericop(GET_OPCODE(i));
+  int pc = J->pc;
+  int ra = REG(GETARG_A(i));
+  switch (op) {
+    case OP_MOVE: {
+      copytv(J, RBX, ra, RBX, REG(GETARG_B(i)));
+      break;
+    }
+    case OP_LOADK: {
+      movri(J, RAX, J->p->k + GETARG_Bx(i));
+      copytv(J, RBX, ra, RAX, 0);
+      break;
+    }
+    case OP_LOADBOOL: {
+      movmi(J, RBX, ra + VAL, GETARG_B(i));
+      movmi(J, RBX, ra + TT, LUA_TBOOLEAN);
+      if (GETARG_C(i))
+        jumpto(J, CC_ALWAYS, pc + 2);
+      break;
+    }
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      if (b > 16)
+        return 0;
+      do {
+        movmi(J, RBX, ra + REG(b) + TT, LUA_TNIL);
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL: {
+      upvaladdr(J, RAX, GETARG_B(i));
+      copytv(J, RBX, ra, RAX, 0);
+      break;
+    }
+    case OP_GETTABUP: case OP_GETTABUPTAB: gettable(J, i, 1); break;
+    case OP_GETTABLE: gettable(J, i, 0); break;
+    case OP_SETTABUP: settable(J, i, 1); break;
+    case OP_SETTABLE: settable(J, i, 0); break;
+    case OP_ADD: case OP_ADDFORLOOP: arith(J, i, X_ADD, X_ADDSD); break;
+    case OP_SUB: arith(J, i, X_SUB, X_SUBSD); break;
+    case OP_MUL: arith(J, i, X_IMUL, X_MULSD); break;
+    case OP_MOD: mod(J, i); break;
+    case OP_DIV: arith(J, i, 0, X_DIVSD); break;
+    case OP_UNM: unm(J, i); break;
+    case OP_NOT: {
+      size_t f[2];
+      emitb(J, 0xb8 | RDX);  /* mov edx, 1 */
+      emitd(J, 1);
+      testfalse(J, REG(GETARG_B(i)), f);
+      opr(J, 0, 0, 0x31, RDX, RDX);  /* xor edx, edx */
+      here(J, f[0]);
+      here(J, f[1]);
+      opm(J, 0, 0, X_MOVST, RDX, RBX, ra + VAL);
+      movmi(J, RBX, ra + TT, LUA_TBOOLEAN);
+      break;
+    }
+    case OP_JMP: {
+      int target = pc + 1 + GETARG_sBx(i);
+      if (GETARG_A(i) != 0)  /* must close upvalues? */
+        return 0;
+      if (target <= pc)
+        backedge(J, target);
+      else
+        jumpto(J, CC_ALWAYS, target);
+      break;
+    }
+    case OP_EQ: case OP_LT: case OP_LE: compare(J, i, op); break;
+    case OP_TEST: {  /* if not (R(A) <=> C) then pc++ */
+      int c = GETARG_C(i);
+      size_t f[2];
+      testfalse(J, ra, f);
+      jumpto(J, CC_ALWAYS, c ? pc + 1 : pc + 2);
+      here(J, f[0]);
+      here(J, f[1]);
+      jumpto(J, CC_ALWAYS, c ? pc + 2 : pc + 1);
+      break;
+    }
+    case OP_TESTSET: {  /* if (R(B) <=> C) then R(A) := R(B) else pc++ */
+      int rb = REG(GETARG_B(i));
+      int c = GETARG_C(i);
+      size_t f[2];
+      testfalse(J, rb, f);
+      if (c)
+        copytv(J, RBX, ra, RBX, rb);
+      jumpto(J, CC_ALWAYS, c ? pc + 1 : pc + 2);
+      here(J, f[0]);
+      here(J, f[1]);
+      if (!c)
+        copytv(J, RBX, ra, RBX, rb);
+      jumpto(J, CC_ALWAYS, c ? pc + 2 : pc + 1);
+      break;
+    }
+    case OP_FORLOOP: forloop(J, i); break;
+    case OP_FORPREP: {  /* integer loops only */
+      cmpmi(J, RBX, ra + TT, LUA_TNUMINT);
+      exitto(J, CC_NE, pc);
+      cmpmi(J, RBX, ra + REG(1) + TT, LUA_TNUMINT);
+      exitto(J, CC_NE, pc);
+      cmpmi(J, RBX, ra + REG(2) + TT, LUA_TNUMINT);
+      exitto(J, CC_NE, pc);
+      opm(J, 0, 1, X_MOVLD, RAX, RBX, ra + VAL);
+      opm(J, 0, 1, X_SUB, RAX, RBX, ra + REG(2) + VAL);
+      opm(J, 0, 1, X_MOVST, RAX, RBX, ra + VAL);
+      jumpto(J, CC_ALWAYS, pc + 1 + GETARG_sBx(i));
+      break;
+    }
+    case OP_TFORLOOP: {  /* if R(A+1) ~= nil then { R(A)=R(A+1); pc += sBx } */
+      size_t done;
+      cmpmi(J, RBX, ra + REG(1) + TT, LUA_TNIL);
+      done = jump(J, CC_E);
+      copytv(J, RBX, ra, RBX, ra + REG(1));
+      backedge(J, pc + 1 + GETARG_sBx(i));
+      here(J, done);
+      break;
+    }
+    default: return 0;
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+static void *mapmem (size_t size) {
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return (p == MAP_FAILED) ? NULL : p;
+}
+
+
+#define pageround(n)	(((n) + 4095) & ~cast(size_t, 4095))
+
+
+/*
+** Generates the code of 'p': entry routine (called with L, ci and the
+** address to start at), return sequence, code of each instruction and
+** exit stubs.
+*/
+static void generate (JitState *J) {
+  Proto *p = J->p;
+  int pc, k;
+  emitb(J, 0x53);  /* push rbx */
+  emitb(J, 0x41); emitb(J, 0x55);  /* push r13 */
+  emitb(J, 0x41); emitb(J, 0x56);  /* push r14 */
+  opr(J, 0, 1, X_MOVST, RDI, R13);  /* mov r13, rdi */
+  opr(J, 0, 1, X_MOVST, RSI, R14);  /* mov r14, rsi */
+  opm(J, 0, 1, X_MOVLD, RBX, R14, cast_int(offsetof(CallInfo, u.l.base)));
+  emitb(J, 0xff); emitb(J, 0xe2);  /* jmp rdx */
+  J->epilogue = J->n;
+  emitb(J, 0x41); emitb(J, 0x5e);  /* pop r14 */
+  emitb(J, 0x41); emitb(J, 0x5d);  /* pop r13 */
+  emitb(J, 0x5b);  /* pop rbx */
+  emitb(J, 0xc3);  /* ret */
+  for (pc = 0; pc < p->sizecode; pc++) {
+    unsigned int start = cast(unsigned int, J->n);
+    J->pc = pc;
+    J->exitpos[pc] = 0;
+    if (compileinst(J, p->code[pc]))
+      J->pos[pc] = start;
+    else {  /* leave it to the interpreter */
+      J->pos[pc] = 0;
+      J->exitpos[pc] = start;
+      emitexit(J, pc);
+    }
+    lua_assert(J->n - start <= MAXTEMPLATE);
+  }
+  for (k = 0; k < J->nfix; k++) {  /* patch jumps, adding exit stubs */
+    Fixup *f = &J->fix[k];
+    size_t target;
+    if (f->toexit || J->pos[f->pc] == 0) {
+      if (J->exitpos[f->pc] == 0) {
+        J->exitpos[f->pc] = cast(unsigned int, J->n);
+        emitexit(J, f->pc);
+      }
+      target = J->exitpos[f->pc];
+    }
+    else
+      target = J->pos[f->pc];
+    patch(J, f->pos, target);
+  }
+}
+
+
+void luaJ_compile (lua_State *L, Proto *p) {
+  JitState J;
+  JitCode *jc;
+  int n = p->sizecode;
+  size_t size = pageround(cast(size_t, n) * (MAXTEMPLATE + EXITSIZE) + 256);
+  size_t tsize = cast(size_t, n) * (2 * sizeof(unsigned int) +
+                                    MAXFIXUPS * sizeof(Fixup));
+  void *temp;
+  if (G(L)->jitoff) {  /* disabled? try again later */
+    p->jitcount = JITTHRESHOLD;
+    return;
+  }
+  jc = cast(JitCode *, luaM_malloc(L, sizejitcode(n)));
+  J.code = cast(lu_byte *, mapmem(size));
+  temp = mapmem(pageround(tsize));
+  if (J.code == NULL || temp == NULL) {  /* no memory? give up */
+    if (J.code) munmap(J.code, size);
+    if (temp) munmap(temp, pageround(tsize));
+    luaM_freemem(L, jc, sizejitcode(n));
+    return;
+  }
+  J.p = p;
+  J.n = 0;
+  J.fix = cast(Fixup *, temp);
+  J.pos = cast(unsigned int *, J.fix + cast(size_t, n) * MAXFIXUPS);
+  J.exitpos = J.pos + n;
+  J.nfix = 0;
+  generate(&J);
+  memcpy(jc->entry, J.pos, n * sizeof(unsigned int));
+  munmap(temp, pageround(tsize));
+  jc->size = pageround(J.n);
+  if (jc->size < size)  /* release unused pages */
+    munmap(J.code + jc->size, size - jc->size);
+  if (mprotect(J.code, jc->size, PROT_READ | PROT_EXEC) != 0) {
+    /* cannot execute it (e.g., a W^X policy)? stay interpreted */
+    munmap(J.code, jc->size);
+    luaM_freemem(L, jc, sizejitcode(n));
+    return;
+  }
+  jc->mcode = J.code;
+  p->jit = jc;
+}
+
+
+void luaJ_run (lua_State *L, CallInfo *ci, Proto *p) {
+  JitCode *jc = p->jit;
+  unsigned int off = jc->entry[ci->u.l.savedpc - p->code];
+  if (off != 0 && !L->hookmask && !G(L)->jitoff) {
+    union { lu_byte *p; JitFunction f; } u;
+    u.p = jc->mcode;
+    u.f(L, ci, jc->mcode + off);
+  }
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  JitCode *jc = p->jit;
+  munmap(jc->mcode, jc->size);
+  luaM_freemem(L, jc, sizejitcode(p->sizecode));
+}
+
+#endif
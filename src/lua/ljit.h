@@ -0,0 +1,35 @@
+/*
+** $Id: ljit.h $
+** Baseline compiler from Lua bytecode to x86-64 machine code
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** number of calls, returns and loop iterations of a function before
+** it is compiled
+*/
+#if !defined(JITTHRESHOLD)
+#define JITTHRESHOLD	1000
+#endif
+
+
+#if defined(LUA_USE_JIT)
+
+LUAI_FUNC void luaJ_compile (lua_State *L, Proto *p);
+LUAI_FUNC void luaJ_run (lua_State *L, CallInfo *ci, Proto *p);
+LUAI_FUNC void luaJ_free (lua_State *L, Proto *p);
+
+#else
+
+#define luaJ_free(L,p)		((void)0)
+
+#endif
+
+#endif
@@ -67,6 +67,102 @@ static void save (LexState *ls, int c) {
 }
 
 
+/*
+** {======================================================
+** Fast paths: scan the characters already in the input buffer
+** ('z->p', 'z->n') in bulk instead of going through 'next' for each
+** one. Scans stop at the end of the buffer, and the character-by-
+** character code goes on from there (with a new buffer).
+** =======================================================
+*/
+
+#if defined(LUA_USE_SIMD)
+#include <emmintrin.h>
+#endif
+
+/* append 'l' chars from 's' to the token buffer */
+static void savespan (LexState *ls, const char *s, size_t l) {
+  Mbuffer *b = ls->buff;
+  if (luaZ_bufflen(b) + l > luaZ_sizebuffer(b)) {
+    size_t newsize = luaZ_sizebuffer(b);
+    do {
+      if (newsize >= MAX_SIZE/2)
+        lexerror(ls, "lexical element too long", 0);
+      newsize *= 2;
+    } while (luaZ_bufflen(b) + l > newsize);
+    luaZ_resizebuffer(ls->L, b, newsize);
+  }
+  memcpy(b->buffer + luaZ_bufflen(b), s, l);
+  luaZ_bufflen(b) += l;
+}
+
+
+/* consume 'l' chars from the input buffer */
+static void skipspan (ZIO *z, size_t l) {
+  z->p += l;
+  z->n -= l;
+}
+
+
+/*
+** Length of the prefix of 'p[0..n)' without chars 'c1', 'c2', 'c3' and
+** 'c4'
+*/
+static size_t spanuntil (const char *p, size_t n, int c1, int c2, int c3,
+                                                  int c4) {
+  size_t i = 0;
+#if defined(LUA_USE_SIMD)
+  const __m128i v1 = _mm_set1_epi8((char)c1), v2 = _mm_set1_epi8((char)c2);
+  const __m128i v3 = _mm_set1_epi8((char)c3), v4 = _mm_set1_epi8((char)c4);
+  for (; i + 16 <= n; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i m = _mm_or_si128(
+                  _mm_or_si128(_mm_cmpeq_epi8(s, v1), _mm_cmpeq_epi8(s, v2)),
+                  _mm_or_si128(_mm_cmpeq_epi8(s, v3), _mm_cmpeq_epi8(s, v4)));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(m);
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+#endif
+  for (; i < n; i++) {
+    int c = cast_uchar(p[i]);
+    if (c == c1 || c == c2 || c == c3 || c == c4)
+      break;
+  }
+  return i;
+}
+
+
+/* length of the prefix of 'p[0..n)' made of blanks and tabs */
+static size_t spanspaces (const char *p, size_t n) {
+  size_t i = 0;
+#if defined(LUA_USE_SIMD)
+  const __m128i blank = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+  for (; i + 16 <= n; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(p + i));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(
+             _mm_or_si128(_mm_cmpeq_epi8(s, blank), _mm_cmpeq_epi8(s, tab)));
+    if (mask != 0xffff)
+      return i + __builtin_ctz(~mask);
+  }
+#endif
+  while (i < n && (p[i] == ' ' || p[i] == '\t'))
+    i++;
+  return i;
+}
+
+
+/* length of the prefix of 'p[0..n)' that can continue a name */
+static size_t spanname (const char *p, size_t n) {
+  size_t i = 0;
+  while (i < n && lislalnum(cast_uchar(p[i])))
+    i++;
+  return i;
+}
+
+/* }====================================================== */
+
+
 void luaX_init (lua_State *L) {
   int i;
   TString *e = luaS_newliteral(L, LUA_ENV);  /* create env name */
@@ -136,7 +232,8 @@ TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
     setbvalue(o, 1);  /* t[string] = true */
     luaC_checkGC(L);
   }
-  else {  /* string already present */
+  else if (ts->tt == LUA_TLNGSTR) {  /* long string already present? */
+    /* (short strings are unique, and may be kept in a slot) */
     ts = tsvalue(keyfromval(o));  /* re-use value previously stored */
   }
   L->top--;  /* remove string from stack */
@@ -289,8 +386,14 @@ static void read_long_string (LexState *ls, SemInfo *seminfo, int sep) {
         break;
       }
       default: {
-        if (seminfo) save_and_next(ls);
-        else next(ls);
+        ZIO *z = ls->z;
+        size_t l = spanuntil(z->p, z->n, ']', '\n', '\r', ']');
+        if (seminfo) {
+          save(ls, ls->current);
+          savespan(ls, z->p, l);
+        }
+        skipspan(z, l);
+        next(ls);
       }
     }
   } endloop:
@@ -416,8 +519,14 @@ static void read_string (LexState *ls, int del, SemInfo *seminfo) {
          /* go through */
        no_save: break;
       }
-      default:
-        save_and_next(ls);
+      default: {
+        ZIO *z = ls->z;
+        size_t l = spanuntil(z->p, z->n, del, '\\', '\n', '\r');
+        save(ls, ls->current);
+        savespan(ls, z->p, l);
+        skipspan(z, l);
+        next(ls);
+      }
     }
   }
   save_and_next(ls);  /* skip delimiter */
@@ -435,6 +544,7 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         break;
       }
       case ' ': case '\f': case '\t': case '\v': {  /* spaces */
+        skipspan(ls->z, spanspaces(ls->z->p, ls->z->n));
         next(ls);
         break;
       }
@@ -453,8 +563,11 @@ static int llex (LexState *ls, SemInfo *seminfo) {
           }
         }
         /* else short comment */
-        while (!currIsNewline(ls) && ls->current != EOZ)
-          next(ls);  /* skip until end of line (or end of file) */
+        while (!currIsNewline(ls) && ls->current != EOZ) {
+          ZIO *z = ls->z;  /* skip until end of line (or end of file) */
+          skipspan(z, spanuntil(z->p, z->n, '\n', '\r', '\n', '\r'));
+          next(ls);
+        }
         break;
       }
       case '[': {  /* long string or simply '[' */
@@ -524,7 +637,12 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         if (lislalpha(ls->current)) {  /* identifier or reserved word? */
           TString *ts;
           do {
-            save_and_next(ls);
+            ZIO *z = ls->z;
+            size_t l = spanname(z->p, z->n);
+            save(ls, ls->current);
+            savespan(ls, z->p, l);
+            skipspan(z, l);
+            next(ls);
           } while (lislalnum(ls->current));
           ts = luaX_newstring(ls, luaZ_buffer(ls->buff),
                                   luaZ_bufflen(ls->buff));
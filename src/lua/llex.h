@@ -69,6 +69,7 @@ typedef struct LexState {
   struct Dyndata *dyd;  /* dynamic structures used by the parser */
   TString *source;  /* current source name */
   TString *envn;  /* environment variable name */
+  int optimize;  /* run 'luaK_optimize' on each function */
 } LexState;
 
 
@@ -154,6 +154,31 @@ typedef LUAI_UACINT l_uacInt;
 #endif
 
 
+/*
+** maximum number of string keys a table keeps in a shared shape before
+** falling back to a regular hash part (0 disables shapes; must fit in a
+** byte)
+*/
+#if !defined(LUAI_MAXSHAPE)
+#define LUAI_MAXSHAPE		16
+#endif
+
+
+/*
+** hash parts with at least 2^LUAI_INCREHASHBITS nodes are resized
+** incrementally, moving LUAI_REHASHSTEP old nodes to the new part for
+** each new key (define LUAI_INCREHASHBITS larger than 30 to always
+** rehash at once)
+*/
+#if !defined(LUAI_INCREHASHBITS)
+#define LUAI_INCREHASHBITS	16
+#endif
+
+#if !defined(LUAI_REHASHSTEP)
+#define LUAI_REHASHSTEP		64
+#endif
+
+
 
 /*
 ** type for virtual-machine instructions;
@@ -224,6 +249,21 @@ typedef unsigned long Instruction;
 #endif
 
 
+/*
+** cheap monotonic counter used to time calls (see 'lua_callstats');
+** 'lua_funcstats' converts it to nanoseconds
+*/
+typedef lu_mem lu_ticks;
+
+#if !defined(luai_ticks)
+#if defined(__GNUC__) && defined(__x86_64__)
+#define luai_ticks()	cast(lu_ticks, __builtin_ia32_rdtsc())
+#else
+#define luai_ticks()	cast(lu_ticks, luaE_nanotime())
+#endif
+#endif
+
+
 /*
 ** these macros allow user-specific actions on threads when you defined
 ** LUAI_EXTRASPACE and need to do something extra when a thread is
@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 
+#include <float.h>
 #include <locale.h>
 #include <math.h>
 #include <stdarg.h>
@@ -33,6 +34,25 @@
 LUAI_DDEF const TValue luaO_nilobject_ = {NILCONSTANT};
 
 
+#if defined(LUA_NANBOXING)
+
+LUAI_DDEF const lu_byte luaO_nbtag2tt[16] = {
+  LUA_TNIL, LUA_TBOOLEAN, LUA_TLIGHTUSERDATA, LUA_TNUMINT, LUA_TLCF,
+  LUA_TDEADKEY, ctb(LUA_TSHRSTR), ctb(LUA_TLNGSTR), ctb(LUA_TLCL),
+  ctb(LUA_TCCL), ctb(LUA_TTABLE), ctb(LUA_TUSERDATA), ctb(LUA_TTHREAD),
+  ctb(LUA_TPROTO), LUA_TNIL, LUA_TNIL
+};
+
+LUAI_DDEF const lu_byte luaO_tt2nbtag[64] = {
+  [LUA_TSHRSTR] = NBT_SHRSTR, [LUA_TLNGSTR] = NBT_LNGSTR,
+  [LUA_TLCL] = NBT_LCL, [LUA_TCCL] = NBT_CCL, [LUA_TTABLE] = NBT_TABLE,
+  [LUA_TUSERDATA] = NBT_UDATA, [LUA_TTHREAD] = NBT_THREAD,
+  [LUA_TPROTO] = NBT_PROTO
+};
+
+#endif
+
+
 /*
 ** converts an integer to a "floating point byte", represented as
 ** (eeeeexxx), where the real value is (1xxx) * 2^(eeeee - 1) if
@@ -243,6 +263,225 @@ static lua_Number lua_strx2number (const char *s, char **endptr) {
 /* }====================================================== */
 
 
+#if defined(LUA_USE_FASTNUM)
+/*
+** {======================================================
+** Fast number conversions (see LUA_USE_FASTNUM in luaconf.h)
+** =======================================================
+*/
+
+/* powers of 10 that are exact in a double */
+static const lua_Number exactpow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/*
+** Same as 'strtod'. Numerals with at most 19 significant digits, whose
+** value is an integer up to 2^53 times or divided by a power of 10 up
+** to 1e22, need a single correctly rounded operation (Clinger's fast
+** path); everything else (and anything followed by something other
+** than spaces, which 'strtod' may read differently according to the
+** locale) goes to 'strtod'.
+*/
+lua_Number luaO_str2number (const char *s, char **endptr) {
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+  const char *p = s;
+  lua_Unsigned m = 0;
+  int nd = 0;  /* number of significant digits */
+  int e = 0;  /* decimal exponent */
+  int empty = 1;
+  int neg;
+  lua_Number r;
+  while (lisspace(cast_uchar(*p))) p++;
+  neg = isneg(&p);
+  for (; lisdigit(cast_uchar(*p)); p++, empty = 0) {
+    if ((m != 0 || *p != '0') && ++nd > 19) goto slow;
+    m = m * 10 + (*p - '0');
+  }
+  if (*p == '.') {
+    for (p++; lisdigit(cast_uchar(*p)); p++, empty = 0, e--) {
+      if ((m != 0 || *p != '0') && ++nd > 19) goto slow;
+      m = m * 10 + (*p - '0');
+    }
+  }
+  if (empty) goto slow;
+  if (*p == 'e' || *p == 'E') {
+    int exp = 0;
+    int eneg;
+    p++;
+    eneg = isneg(&p);
+    if (!lisdigit(cast_uchar(*p))) goto slow;
+    for (; lisdigit(cast_uchar(*p)); p++)
+      if (exp < 10000) exp = exp * 10 + (*p - '0');
+    e += (eneg) ? -exp : exp;
+  }
+  if (*p != '\0' && !lisspace(cast_uchar(*p)))
+    goto slow;
+  if (m == 0)
+    r = 0;
+  else if (m > ((lua_Unsigned)1 << 53) || e < -22 || e > 22)
+    goto slow;
+  else if (e < 0)
+    r = cast_num(m) / exactpow10[-e];
+  else
+    r = cast_num(m) * exactpow10[e];
+  *endptr = cast(char *, p);
+  return (neg) ? -r : r;
+ slow:
+#endif
+  return strtod(s, endptr);
+}
+
+
+static const char digitpairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+
+/* write the decimal digits of 'u' into 'buff' (without a '\0') */
+static int fmtunsigned (char *buff, lua_Unsigned u) {
+  char tmp[3 * sizeof(lua_Unsigned)];
+  char *p = tmp + sizeof(tmp);
+  int len;
+  for (; u >= 100; u /= 100) {
+    const char *d = digitpairs + (u % 100) * 2;
+    *--p = d[1];
+    *--p = d[0];
+  }
+  if (u >= 10) {
+    *--p = digitpairs[u * 2 + 1];
+    *--p = digitpairs[u * 2];
+  }
+  else
+    *--p = cast(char, '0' + u);
+  len = cast_int(tmp + sizeof(tmp) - p);
+  memcpy(buff, p, len);
+  return len;
+}
+
+
+/* same as "%lld" */
+int luaO_int2str (char *buff, size_t sz, lua_Integer i) {
+  int len = 0;
+  lua_Unsigned u = l_castS2U(i);
+  UNUSED(sz);
+  if (i < 0) {
+    buff[len++] = '-';
+    u = 0u - u;
+  }
+  len += fmtunsigned(buff + len, u);
+  buff[len] = '\0';
+  return len;
+}
+
+
+#if LDBL_MANT_DIG == 64
+/* powers of 10 that are exact in an x87 'long double' */
+static const long double exactpow10l[] = {
+  1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L, 1e10L,
+  1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L, 1e20L,
+  1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L
+};
+#endif
+
+
+/*
+** Compute the 14 significant digits of 'v' (positive) as "%.14g"
+** rounds them, with 'v' = 'd' * 10^('e10' - 13). Integers below 1e14
+** are exact; other values are scaled by a power of 10 with a single
+** 'long double' rounding (when 'long double' is x87's), which is off by
+** less than 1e-5 in the last digit, so the rounding is right unless it
+** is that close to a tie. Returns 0 when it cannot be sure.
+*/
+static int float2digits (lua_Number v, lua_Unsigned *d, int *e10) {
+  if (v >= 1 && v < 1e14 && cast_num(*d = (lua_Unsigned)v) == v) {
+    lua_Unsigned t = *d;
+    for (*e10 = 0; t >= 10; t /= 10) (*e10)++;
+    *d *= (lua_Unsigned)exactpow10[13 - *e10];
+    return 1;
+  }
+#if LDBL_MANT_DIG == 64
+  if (v >= 1e-14 && v < 1e40) {
+    int b, p;
+    long double s, frac;
+    l_mathop(frexp)(v, &b);
+    *e10 = cast_int(l_floor((b - 1) * 0.30102999566398120));
+    for (;;) {  /* estimated exponent may be one too small */
+      p = 13 - *e10;
+      if (p < -27 || p > 27) return 0;
+      s = (p >= 0) ? (long double)v * exactpow10l[p]
+                   : (long double)v / exactpow10l[-p];
+      if (s < 1e14L) break;
+      (*e10)++;
+    }
+    *d = (lua_Unsigned)s;
+    frac = s - (long double)*d;
+    if (frac > 0.5L - 1e-5L && frac < 0.5L + 1e-5L)
+      return 0;  /* too close to a tie */
+    if (frac > 0.5L && ++*d == (lua_Unsigned)1e14) {  /* rounds up to 10^14? */
+      *d = (lua_Unsigned)1e13;
+      (*e10)++;
+    }
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+
+/* same as "%.14g" (LUA_NUMBER_FMT) */
+int luaO_num2str (char *buff, size_t sz, lua_Number n) {
+  char digits[14];
+  lua_Unsigned d;
+  int e10, nd, len = 0;
+  if (!float2digits((n < 0) ? -n : n, &d, &e10))
+    return l_sprintf(buff, sz, LUA_NUMBER_FMT, (LUAI_UACNUMBER)n);
+  fmtunsigned(digits, d);
+  for (nd = 14; digits[nd - 1] == '0'; nd--) ;  /* remove trailing zeros */
+  if (n < 0) buff[len++] = '-';
+  if (e10 < -4 || e10 >= 14) {  /* exponent notation */
+    buff[len++] = digits[0];
+    if (nd > 1) {
+      buff[len++] = lua_getlocaledecpoint();
+      memcpy(buff + len, digits + 1, nd - 1);
+      len += nd - 1;
+    }
+    buff[len++] = 'e';
+    buff[len++] = (e10 < 0) ? '-' : '+';
+    if (e10 < 0) e10 = -e10;
+    if (e10 < 10) buff[len++] = '0';
+    len += fmtunsigned(buff + len, e10);
+  }
+  else if (e10 >= 0) {  /* 'e10 + 1' digits before the point */
+    memcpy(buff + len, digits, e10 + 1);
+    len += e10 + 1;
+    if (nd > e10 + 1) {
+      buff[len++] = lua_getlocaledecpoint();
+      memcpy(buff + len, digits + e10 + 1, nd - e10 - 1);
+      len += nd - e10 - 1;
+    }
+  }
+  else {  /* "0." followed by '-e10 - 1' zeros */
+    buff[len++] = '0';
+    buff[len++] = lua_getlocaledecpoint();
+    memset(buff + len, '0', -e10 - 1);
+    len += -e10 - 1;
+    memcpy(buff + len, digits, nd);
+    len += nd;
+  }
+  buff[len] = '\0';
+  return len;
+}
+
+/* }====================================================== */
+#endif
+
+
 /* maximum length of a numeral */
 #if !defined (L_MAXLENNUM)
 #define L_MAXLENNUM	200
@@ -361,21 +600,17 @@ int luaO_utf8esc (char *buff, unsigned long x) {
 }
 
 
-/* maximum length of the conversion of a number to a string */
-#define MAXNUMBER2STR	50
-
-
 /*
-** Convert a number object to a string
+** Convert a number object to a string in 'buff', which must have
+** LUA_MAXNUMBER2STR bytes; returns its length
 */
-void luaO_tostring (lua_State *L, StkId obj) {
-  char buff[MAXNUMBER2STR];
+size_t luaO_tostringbuff (const TValue *obj, char *buff) {
   size_t len;
   lua_assert(ttisnumber(obj));
   if (ttisinteger(obj))
-    len = lua_integer2str(buff, sizeof(buff), ivalue(obj));
+    len = lua_integer2str(buff, LUA_MAXNUMBER2STR, ivalue(obj));
   else {
-    len = lua_number2str(buff, sizeof(buff), fltvalue(obj));
+    len = lua_number2str(buff, LUA_MAXNUMBER2STR, fltvalue(obj));
 #if !defined(LUA_COMPAT_FLOATSTRING)
     if (buff[strspn(buff, "-0123456789")] == '\0') {  /* looks like an int? */
       buff[len++] = lua_getlocaledecpoint();
@@ -383,6 +618,16 @@ void luaO_tostring (lua_State *L, StkId obj) {
     }
 #endif
   }
+  return len;
+}
+
+
+/*
+** Convert a number object to a string
+*/
+void luaO_tostring (lua_State *L, StkId obj) {
+  char buff[LUA_MAXNUMBER2STR];
+  size_t len = luaO_tostringbuff(obj, buff);
   setsvalue2s(L, obj, luaS_newlstr(L, buff, len));
 }
 
@@ -461,7 +706,7 @@ const char *luaO_pushvfstring (lua_State *L, const char *fmt, va_list argp) {
   luaD_checkstack(L, 1);
   pushstr(L, fmt, strlen(fmt));
   if (n > 0) luaV_concat(L, n + 1);
-  return svalue(L->top - 1);
+  return luaS_tocstr(L, tsvalue(L->top - 1));
 }
 
 
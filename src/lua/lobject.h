@@ -94,6 +94,8 @@ struct GCObject {
 ** an actual value plus a tag with its type.
 */
 
+#if !defined(LUA_NANBOXING)	/* { */
+
 /*
 ** Union of all Lua values
 */
@@ -254,6 +256,220 @@ typedef struct lua_TValue {
 
 #define setdeadvalue(obj)	settt_(obj, LUA_TDEADKEY)
 
+#else				/* }{ */
+
+/*
+** NaN boxing ('LUA_NANBOXING'): a TValue is a single 64-bit word.
+** Floats are kept as themselves, except that every NaN is stored as
+** the canonical (positive quiet) NaN; that frees the whole negative
+** quiet NaN space (top 13 bits set) for all other values: bits 47-50
+** keep a box tag ('NBT_*') and bits 0-46 the payload (a pointer, a
+** 32-bit integer, or a boolean). Pointers (including light userdata)
+** must fit in 47 bits, which holds for user-space x86-64 addresses.
+*/
+
+typedef unsigned long long l_nbox;
+
+typedef union Value {
+  l_nbox nb;      /* whole boxed word */
+  lua_Number n;   /* float numbers */
+} Value;
+
+
+#define TValuefields	Value value_
+
+
+typedef struct lua_TValue {
+  TValuefields;
+} TValue;
+
+
+/* box tags; collectable values have tags from NBT_SHRSTR to NBT_PROTO */
+#define NBT_NIL		0
+#define NBT_BOOLEAN	1
+#define NBT_LIGHTUD	2
+#define NBT_INT		3
+#define NBT_LCF		4
+#define NBT_DEADKEY	5
+#define NBT_SHRSTR	6  /* strings share all bits but the last one */
+#define NBT_LNGSTR	7
+#define NBT_LCL		8  /* and so do closures */
+#define NBT_CCL		9
+#define NBT_TABLE	10
+#define NBT_UDATA	11
+#define NBT_THREAD	12
+#define NBT_PROTO	13
+
+#define NBTAGSHIFT	47
+#define NBPAYLOAD	((cast(l_nbox, 1) << NBTAGSHIFT) - 1)
+#define NBBOXHIGH	0x1FFF0ULL  /* bits 47-63 of a boxed value with tag 0 */
+#define nbboxed(t)	((NBBOXHIGH | cast(l_nbox, t)) << NBTAGSHIFT)
+#define NBCANONICALNAN	0x7FF8000000000000ULL
+
+/* box tag of a TValue (some value > 15 for floats) */
+#define nbtag(o)	((val_(o).nb >> NBTAGSHIFT) - NBBOXHIGH)
+#define nbcheck(o,t)	((val_(o).nb >> NBTAGSHIFT) == (NBBOXHIGH | (t)))
+#define nbpayload(o)	(val_(o).nb & NBPAYLOAD)
+#define nbset(o,t,p)	(val_(o).nb = nbboxed(t) | cast(l_nbox, p))
+
+
+/* macro defining a nil value */
+#define NILCONSTANT	{nbboxed(NBT_NIL)}
+
+
+#define val_(o)		((o)->value_)
+
+
+/* map from box tags to Lua tags */
+LUAI_DDEC const lu_byte luaO_nbtag2tt[16];
+
+/* raw type tag of a TValue */
+#define rttype(o)  \
+	(nbtag(o) < 16 ? cast_int(luaO_nbtag2tt[nbtag(o)]) : LUA_TNUMFLT)
+
+/* tag with no variants (bits 0-3) */
+#define novariant(x)	((x) & 0x0F)
+
+/* type tag of a TValue (bits 0-3 for tags + variant bits 4-5) */
+#define ttype(o)	(rttype(o) & 0x3F)
+
+/* type tag of a TValue with no variants (bits 0-3) */
+#define ttnov(o)	(novariant(rttype(o)))
+
+
+/* Macros to test type */
+#define checktag(o,t)		(rttype(o) == (t))
+#define checktype(o,t)		(ttnov(o) == (t))
+#define ttisnumber(o)		(ttisfloat(o) || ttisinteger(o))
+#define ttisfloat(o)		(val_(o).nb < nbboxed(0))
+#define ttisinteger(o)		nbcheck((o), NBT_INT)
+#define ttisnil(o)		nbcheck((o), NBT_NIL)
+#define ttisboolean(o)		nbcheck((o), NBT_BOOLEAN)
+#define ttislightuserdata(o)	nbcheck((o), NBT_LIGHTUD)
+#define ttisstring(o)  \
+	((val_(o).nb >> (NBTAGSHIFT + 1)) == ((NBBOXHIGH | NBT_SHRSTR) >> 1))
+#define ttisshrstring(o)	nbcheck((o), NBT_SHRSTR)
+#define ttislngstring(o)	nbcheck((o), NBT_LNGSTR)
+#define ttistable(o)		nbcheck((o), NBT_TABLE)
+#define ttisfunction(o)		(ttisclosure(o) || ttislcf(o))
+#define ttisclosure(o)  \
+	((val_(o).nb >> (NBTAGSHIFT + 1)) == ((NBBOXHIGH | NBT_LCL) >> 1))
+#define ttisCclosure(o)		nbcheck((o), NBT_CCL)
+#define ttisLclosure(o)		nbcheck((o), NBT_LCL)
+#define ttislcf(o)		nbcheck((o), NBT_LCF)
+#define ttisfulluserdata(o)	nbcheck((o), NBT_UDATA)
+#define ttisthread(o)		nbcheck((o), NBT_THREAD)
+#define ttisdeadkey(o)		nbcheck((o), NBT_DEADKEY)
+
+
+/* Macros to access values */
+#define ivalue(o)	check_exp(ttisinteger(o), \
+	l_castU2S(cast(lua_Unsigned, val_(o).nb)))
+#define fltvalue(o)	check_exp(ttisfloat(o), val_(o).n)
+#define nvalue(o)	check_exp(ttisnumber(o), \
+	(ttisinteger(o) ? cast_num(ivalue(o)) : fltvalue(o)))
+#define gcvalue(o)	check_exp(iscollectable(o), \
+	cast(GCObject *, cast(size_t, nbpayload(o))))
+#define pvalue(o)	check_exp(ttislightuserdata(o), \
+	cast(void *, cast(size_t, nbpayload(o))))
+#define tsvalue(o)	check_exp(ttisstring(o), gco2ts(gcvalue(o)))
+#define uvalue(o)	check_exp(ttisfulluserdata(o), gco2u(gcvalue(o)))
+#define clvalue(o)	check_exp(ttisclosure(o), gco2cl(gcvalue(o)))
+#define clLvalue(o)	check_exp(ttisLclosure(o), gco2lcl(gcvalue(o)))
+#define clCvalue(o)	check_exp(ttisCclosure(o), gco2ccl(gcvalue(o)))
+#define fvalue(o)	check_exp(ttislcf(o), \
+	cast(lua_CFunction, cast(size_t, nbpayload(o))))
+#define hvalue(o)	check_exp(ttistable(o), gco2t(gcvalue(o)))
+#define bvalue(o)	check_exp(ttisboolean(o), cast_int(nbpayload(o)))
+#define thvalue(o)	check_exp(ttisthread(o), gco2th(gcvalue(o)))
+/* a dead value may get the 'gc' field, but cannot access its contents */
+#define deadvalue(o)	check_exp(ttisdeadkey(o), \
+	cast(void *, cast(size_t, nbpayload(o))))
+
+#define l_isfalse(o)	(ttisnil(o) || (ttisboolean(o) && bvalue(o) == 0))
+
+
+#define iscollectable(o)	(nbtag(o) - NBT_SHRSTR <= NBT_PROTO - NBT_SHRSTR)
+
+
+/* Macros for internal tests */
+#define righttt(obj)		(ttype(obj) == gcvalue(obj)->tt)
+
+#define checkliveness(L,obj) \
+	lua_longassert(!iscollectable(obj) || \
+		(righttt(obj) && (L == NULL || !isdead(G(L),gcvalue(obj)))))
+
+
+/* map from tags of collectable objects to box tags */
+LUAI_DDEC const lu_byte luaO_tt2nbtag[64];
+
+/* Macros to set values */
+#define setfltvalue(obj,x) \
+  { TValue *io=(obj); val_(io).n=(x); \
+    if (val_(io).nb >= nbboxed(0)) val_(io).nb = NBCANONICALNAN; }
+
+#define chgfltvalue(obj,x) \
+  { TValue *io=(obj); lua_assert(ttisfloat(io)); val_(io).n=(x); \
+    if (val_(io).nb >= nbboxed(0)) val_(io).nb = NBCANONICALNAN; }
+
+#define setivalue(obj,x) \
+  { TValue *io=(obj); nbset(io, NBT_INT, cast(unsigned int, l_castS2U(x))); }
+
+#define chgivalue(obj,x) \
+  { TValue *io=(obj); lua_assert(ttisinteger(io)); \
+    nbset(io, NBT_INT, cast(unsigned int, l_castS2U(x))); }
+
+#define setnilvalue(obj) (val_(obj).nb = nbboxed(NBT_NIL))
+
+#define setfvalue(obj,x) \
+  { TValue *io=(obj); nbset(io, NBT_LCF, cast(size_t, (x))); }
+
+#define setpvalue(obj,x) \
+  { TValue *io=(obj); nbset(io, NBT_LIGHTUD, cast(size_t, (x))); }
+
+#define setbvalue(obj,x) \
+  { TValue *io=(obj); nbset(io, NBT_BOOLEAN, cast(unsigned int, (x))); }
+
+#define setgcovalue(L,obj,x) \
+  { TValue *io = (obj); GCObject *i_g=(x); \
+    nbset(io, luaO_tt2nbtag[i_g->tt], cast(size_t, i_g)); }
+
+#define setsvalue(L,obj,x) \
+  { TValue *io = (obj); TString *x_ = (x); \
+    nbset(io, NBT_SHRSTR + (x_->tt >> 4), cast(size_t, x_)); \
+    checkliveness(L,io); }
+
+#define setuvalue(L,obj,x) \
+  { TValue *io = (obj); Udata *x_ = (x); \
+    nbset(io, NBT_UDATA, cast(size_t, x_)); \
+    checkliveness(L,io); }
+
+#define setthvalue(L,obj,x) \
+  { TValue *io = (obj); lua_State *x_ = (x); \
+    nbset(io, NBT_THREAD, cast(size_t, x_)); \
+    checkliveness(L,io); }
+
+#define setclLvalue(L,obj,x) \
+  { TValue *io = (obj); LClosure *x_ = (x); \
+    nbset(io, NBT_LCL, cast(size_t, x_)); \
+    checkliveness(L,io); }
+
+#define setclCvalue(L,obj,x) \
+  { TValue *io = (obj); CClosure *x_ = (x); \
+    nbset(io, NBT_CCL, cast(size_t, x_)); \
+    checkliveness(L,io); }
+
+#define sethvalue(L,obj,x) \
+  { TValue *io = (obj); Table *x_ = (x); \
+    nbset(io, NBT_TABLE, cast(size_t, x_)); \
+    checkliveness(L,io); }
+
+/* keeps the object pointer (see 'deadvalue') */
+#define setdeadvalue(obj)  \
+	(val_(obj).nb = nbboxed(NBT_DEADKEY) | (val_(obj).nb & NBPAYLOAD))
+
+#endif				/* } */
+
 
 
 #define setobj(L,obj1,obj2) \
@@ -303,7 +519,7 @@ typedef TValue *StkId;  /* index to stack elements */
 typedef struct TString {
   CommonHeader;
   lu_byte extra;  /* reserved words for short strings; "has hash" for longs */
-  lu_byte shrlen;  /* length for short strings */
+  lu_byte shrlen;  /* length for short strings; kind for longs */
   unsigned int hash;
   union {
     size_t lnglen;  /* length for long strings */
@@ -321,12 +537,39 @@ typedef union UTString {
 } UTString;
 
 
+/*
+** Bytes of long strings built by appending to other long strings.
+** Each string using a block is a prefix of it; the longest one can
+** grow in place, so repeated appends do not copy what is already
+** there. Only the longest string is followed by a '\0'.
+*/
+typedef struct StrBlock {
+  lu_mem nref;  /* number of strings using this block */
+  size_t used;  /* length of the longest string */
+  size_t size;  /* room for contents (not counting the final '\0') */
+  lu_byte fixed;  /* longest string was given out as a C string? */
+  char data[1];
+} StrBlock;
+
+
+/* kinds of long strings (field 'shrlen') */
+#define LSTRPLAIN	0	/* bytes follow the header */
+#define LSTRCAT		1	/* same, result of a concatenation */
+#define LSTRBLOCK	255	/* header is followed by a 'StrBlock *' */
+
+
+/* bytes following the header of a 'TString' */
+#define rawgetstr(ts)	(cast(char *, (ts)) + sizeof(UTString))
+
+#define getblock(ts)	(*cast(StrBlock **, rawgetstr(ts)))
+
 /*
 ** Get the actual string (array of bytes) from a 'TString'.
 ** (Access to 'extra' ensures that value is really a 'TString'.)
 */
 #define getstr(ts)  \
-  check_exp(sizeof((ts)->extra), cast(char *, (ts)) + sizeof(UTString))
+  check_exp(sizeof((ts)->extra), \
+    ((ts)->shrlen == LSTRBLOCK ? getblock(ts)->data : rawgetstr(ts)))
 
 
 /* get the actual string (array of bytes) from a Lua value */
@@ -374,10 +617,17 @@ typedef union UUdata {
 	  checkliveness(L,io); }
 
 
+#if !defined(LUA_NANBOXING)
 #define getuservalue(L,u,o) \
 	{ TValue *io=(o); const Udata *iu = (u); \
 	  io->value_ = iu->user_; settt_(io, iu->ttuv_); \
 	  checkliveness(L,io); }
+#else  /* the boxed word in 'user_' already carries the tag */
+#define getuservalue(L,u,o) \
+	{ TValue *io=(o); const Udata *iu = (u); \
+	  io->value_ = iu->user_; \
+	  checkliveness(L,io); }
+#endif
 
 
 /*
@@ -415,15 +665,21 @@ typedef struct Proto {
   int sizelineinfo;
   int sizep;  /* size of 'p' */
   int sizelocvars;
+  int jitcount;  /* entries left before compiling it (see 'ljit.h') */
+  size_t calls;  /* calls made while 'lua_callstats' was on */
+  double selftime;  /* ticks spent in it, but not in called Lua functions */
+  double totaltime;  /* ticks spent from calls to returns */
   int linedefined;  /* debug information  */
   int lastlinedefined;  /* debug information  */
   TValue *k;  /* constants used by the function */
   Instruction *code;  /* opcodes */
+  unsigned int *hints;  /* inline caches, one per opcode (see 'lvm.c') */
   struct Proto **p;  /* functions defined inside the function */
   int *lineinfo;  /* map from opcodes to source lines (debug information) */
   LocVar *locvars;  /* information about local variables (debug information) */
   Upvaldesc *upvalues;  /* upvalue information */
   struct LClosure *cache;  /* last-created closure with this prototype */
+  struct JitCode *jit;  /* machine code for this prototype (or NULL) */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
@@ -482,10 +738,17 @@ typedef union TKey {
 
 
 /* copy a value into a key without messing up field 'next' */
+#if !defined(LUA_NANBOXING)
 #define setnodekey(L,key,obj) \
 	{ TKey *k_=(key); const TValue *io_=(obj); \
 	  k_->nk.value_ = io_->value_; k_->nk.tt_ = io_->tt_; \
 	  (void)L; checkliveness(L,io_); }
+#else
+#define setnodekey(L,key,obj) \
+	{ TKey *k_=(key); const TValue *io_=(obj); \
+	  k_->nk.value_ = io_->value_; \
+	  (void)L; checkliveness(L,io_); }
+#endif
 
 
 typedef struct Node {
@@ -494,16 +757,40 @@ typedef struct Node {
 } Node;
 
 
+/*
+** Shapes describe the string keys of record-like tables: 'keys[i]' is
+** the key whose value is in slot 'i' of every table using the shape.
+** Tables that got the same keys in the same order share one shape;
+** shapes form a tree where each child extends its parent by one key.
+*/
+typedef struct Shape {
+  struct Shape *parent;  /* shape without the last key */
+  struct Shape *child;  /* list of shapes extending this one */
+  struct Shape *sibling;  /* next shape in parent's 'child' list */
+  lu_mem nref;  /* number of tables and children using this shape */
+  lu_byte nkeys;  /* number of keys */
+  TString *keys[1];
+} Shape;
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
   lu_byte lsizenode;  /* log2 of size of 'node' array */
+  lu_byte sizeslots;  /* size of 'slots' array */
+  lu_byte oldlsizenode;  /* log2 of size of 'oldnode' array */
   unsigned int sizearray;  /* size of 'array' array */
+  unsigned int oldpos;  /* nodes of 'oldnode' before it were migrated */
   TValue *array;  /* array part */
   Node *node;
   Node *lastfree;  /* any free position is before this position */
   struct Table *metatable;
   GCObject *gclist;
+  Shape *shape;  /* keys of 'slots' (NULL if table uses 'node') */
+  union {
+    TValue *slots;  /* values of fields described by 'shape' */
+    Node *oldnode;  /* (no shape) hash part being migrated to 'node' */
+  } u;
 } Table;
 
 
@@ -538,7 +825,13 @@ LUAI_FUNC void luaO_arith (lua_State *L, int op, const TValue *p1,
                            const TValue *p2, TValue *res);
 LUAI_FUNC size_t luaO_str2num (const char *s, TValue *o);
 LUAI_FUNC int luaO_hexavalue (int c);
+LUAI_FUNC size_t luaO_tostringbuff (const TValue *obj, char *buff);
 LUAI_FUNC void luaO_tostring (lua_State *L, StkId obj);
+#if defined(LUA_USE_FASTNUM)
+LUAI_FUNC lua_Number luaO_str2number (const char *s, char **endptr);
+LUAI_FUNC int luaO_int2str (char *buff, size_t sz, lua_Integer i);
+LUAI_FUNC int luaO_num2str (char *buff, size_t sz, lua_Number n);
+#endif
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
 LUAI_FUNC const char *luaO_pushfstring (lua_State *L, const char *fmt, ...);
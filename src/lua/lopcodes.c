@@ -65,6 +65,19 @@ LUAI_DDEF const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSURE",
   "VARARG",
   "EXTRAARG",
+  "GETTABUPTAB",
+  "ADDFORLOOP",
+  "ADDII",
+  "ADDFF",
+  "SUBII",
+  "SUBFF",
+  "MULII",
+  "MULFF",
+  "LTII",
+  "LTFF",
+  "LEII",
+  "LEFF",
+  "FORLOOPI",
   NULL
 };
 
@@ -120,5 +133,33 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
  ,opmode(0, 0, OpArgU, OpArgU, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 1, OpArgU, OpArgK, iABC)		/* OP_GETTABUPTAB */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADDFORLOOP */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADDII */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADDFF */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_SUBII */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_SUBFF */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MULII */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MULFF */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LTII */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LTFF */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LEII */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LEFF */
+ ,opmode(0, 1, OpArgR, OpArgN, iAsBx)		/* OP_FORLOOPI */
+};
+
+
+LUAI_DDEF const lu_byte luaP_generic[NUM_OPCODES - FIRST_QUICK] = {
+  OP_ADD		/* OP_ADDII */
+ ,OP_ADD		/* OP_ADDFF */
+ ,OP_SUB		/* OP_SUBII */
+ ,OP_SUB		/* OP_SUBFF */
+ ,OP_MUL		/* OP_MULII */
+ ,OP_MUL		/* OP_MULFF */
+ ,OP_LT		/* OP_LTII */
+ ,OP_LT		/* OP_LTFF */
+ ,OP_LE		/* OP_LEII */
+ ,OP_LE		/* OP_LEFF */
+ ,OP_FORLOOP		/* OP_FORLOOPI */
 };
 
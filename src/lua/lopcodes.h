@@ -230,11 +230,28 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+OP_GETTABUPTAB,/* A B C	R(A) := UpValue[B][RK(C)]; next OP_GETTABLE	*/
+OP_ADDFORLOOP,/*	A B C	R(A) := RK(B) + RK(C); next OP_FORLOOP		*/
+
+OP_ADDII,/*	A B C	R(A) := RK(B) + RK(C)	(integers)		*/
+OP_ADDFF,/*	A B C	R(A) := RK(B) + RK(C)	(floats)		*/
+OP_SUBII,/*	A B C	R(A) := RK(B) - RK(C)	(integers)		*/
+OP_SUBFF,/*	A B C	R(A) := RK(B) - RK(C)	(floats)		*/
+OP_MULII,/*	A B C	R(A) := RK(B) * RK(C)	(integers)		*/
+OP_MULFF,/*	A B C	R(A) := RK(B) * RK(C)	(floats)		*/
+OP_LTII,/*	A B C	if ((RK(B) <  RK(C)) ~= A) then pc++	(integers)	*/
+OP_LTFF,/*	A B C	if ((RK(B) <  RK(C)) ~= A) then pc++	(floats)	*/
+OP_LEII,/*	A B C	if ((RK(B) <= RK(C)) ~= A) then pc++	(integers)	*/
+OP_LEFF,/*	A B C	if ((RK(B) <= RK(C)) ~= A) then pc++	(floats)	*/
+OP_FORLOOPI/*	A sBx	OP_FORLOOP	(integer loop, positive step)	*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_FORLOOPI) + 1)
+
+#define FIRST_QUICK	OP_ADDII
 
 
 
@@ -259,6 +276,16 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 
   (*) All 'skips' (pc++) assume that next instruction is a jump.
 
+  (*) OP_GETTABUPTAB and OP_ADDFORLOOP are superinstructions: the code
+  generator puts them in place of an OP_GETTABUP (OP_ADD) followed by
+  an OP_GETTABLE (OP_FORLOOP), and they also execute that instruction.
+  The second instruction stays in the code, as jumps may go to it.
+
+  (*) Opcodes from FIRST_QUICK on are never generated by the code
+  generator: the interpreter rewrites ("quickens") a generic instruction
+  into one of them when its operands have the types it handles, and
+  back when they do not. 'genericop' gives the original opcode.
+
 ===========================================================================*/
 
 
@@ -289,6 +316,12 @@ LUAI_DDEC const lu_byte luaP_opmodes[NUM_OPCODES];
 
 LUAI_DDEC const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 
+/* generic opcodes of the quickened ones */
+LUAI_DDEC const lu_byte luaP_generic[NUM_OPCODES - FIRST_QUICK];
+
+#define genericop(o)  \
+	((o) < FIRST_QUICK ? (o) : cast(OpCode, luaP_generic[(o) - FIRST_QUICK]))
+
 
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
@@ -12,6 +12,7 @@
 
 #include <stddef.h>
 #include <string.h>
+#include <time.h>
 
 #include "lua.h"
 
@@ -42,7 +43,6 @@
 ** created; the seed is used to randomize hashes.
 */
 #if !defined(luai_makeseed)
-#include <time.h>
 #define luai_makeseed()		cast(unsigned int, time(NULL))
 #endif
 
@@ -105,6 +105,20 @@ void luaE_setdebt (global_State *g, l_mem debt) {
 }
 
 
+/*
+** monotonic clock (in nanoseconds) used to time collector work
+*/
+double luaE_nanotime (void) {
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(double, ts.tv_sec) * 1e9 + cast(double, ts.tv_nsec);
+#else
+  return cast(double, clock()) * (1e9 / CLOCKS_PER_SEC);
+#endif
+}
+
+
 CallInfo *luaE_extendCI (lua_State *L) {
   CallInfo *ci = luaM_new(L, CallInfo);
   lua_assert(L->ci->next == NULL);
@@ -132,13 +146,15 @@ void luaE_freeCI (lua_State *L) {
 
 
 /*
-** free half of the CallInfo structures not in use by a thread
+** free half of the CallInfo structures not in use by a thread, keeping
+** at least 'cireserve' of them
 */
 void luaE_shrinkCI (lua_State *L) {
   CallInfo *ci = L->ci;
   CallInfo *next2;  /* next's next */
   /* while there are two nexts */
-  while (ci->next != NULL && (next2 = ci->next->next) != NULL) {
+  while (L->nci > L->cireserve &&
+         ci->next != NULL && (next2 = ci->next->next) != NULL) {
     luaM_free(L, ci->next);  /* free next */
     L->nci--;
     ci->next = next2;  /* remove 'next' from the list */
@@ -148,6 +164,24 @@ void luaE_shrinkCI (lua_State *L) {
 }
 
 
+/*
+** extend the CallInfo list of a thread to 'cireserve' items
+*/
+void luaE_reserveCI (lua_State *L) {
+  CallInfo *ci = L->ci;
+  while (ci->next != NULL)
+    ci = ci->next;
+  while (L->nci < L->cireserve) {
+    CallInfo *next = luaM_new(L, CallInfo);
+    ci->next = next;
+    next->previous = ci;
+    next->next = NULL;
+    L->nci++;
+    ci = next;
+  }
+}
+
+
 static void stack_init (lua_State *L1, lua_State *L) {
   int i; CallInfo *ci;
   /* initialize stack array */
@@ -224,6 +258,8 @@ static void preinit_thread (lua_State *L, global_State *g) {
   L->ci = NULL;
   L->nci = 0;
   L->stacksize = 0;
+  L->stackreserve = 0;
+  L->cireserve = 0;
   L->twups = L;  /* thread has no upvalues */
   L->errorJmp = NULL;
   L->nCcalls = 0;
@@ -245,6 +281,7 @@ static void close_state (lua_State *L) {
   luaC_freeallobjects(L);  /* collect all objects */
   if (g->version)  /* closing a fully built state? */
     luai_userstateclose(L);
+  luaS_resizestep(L, MAX_INT);  /* finish a pending resize */
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
@@ -312,7 +349,11 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gcrunning = 0;  /* no GC while building state */
   g->GCestimate = 0;
   g->strt.size = g->strt.nuse = 0;
+  g->strt.oldsize = g->strt.oldpos = 0;
   g->strt.hash = NULL;
+  g->rootshape.parent = g->rootshape.child = g->rootshape.sibling = NULL;
+  g->rootshape.nref = 0;
+  g->rootshape.nkeys = 0;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->version = NULL;
@@ -325,9 +366,16 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->twups = NULL;
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
+  g->GCdeferred = 0;
+  g->gcidlelimit = 0;
+  g->jitoff = 0;
+  g->callstats = 0;
+  g->ticks0 = luai_ticks();
+  g->nanos0 = luaE_nanotime();
   g->gcfinnum = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
@@ -77,6 +77,8 @@ typedef struct stringtable {
   TString **hash;
   int nuse;  /* number of elements */
   int size;
+  int oldsize;  /* size before an unfinished resize (0 if none) */
+  int oldpos;  /* number of buckets already split/merged for that resize */
 } stringtable;
 
 
@@ -105,6 +107,8 @@ typedef struct CallInfo {
     } c;
   } u;
   ptrdiff_t extra;
+  lu_ticks tstart;  /* when the call started (if CIST_TIMED) */
+  lu_ticks tchild;  /* ticks spent in called Lua functions (if CIST_TIMED) */
   short nresults;  /* expected number of results from this function */
   unsigned short callstatus;
 } CallInfo;
@@ -123,6 +127,7 @@ typedef struct CallInfo {
 #define CIST_HOOKYIELD	(1<<6)	/* last hook called yielded */
 #define CIST_LEQ	(1<<7)  /* using __lt for __le */
 #define CIST_FIN	(1<<8)  /* call is running a finalizer */
+#define CIST_TIMED	(1<<9)  /* call is being timed ('lua_callstats') */
 
 #define isLua(ci)	((ci)->callstatus & CIST_LUA)
 
@@ -139,15 +144,22 @@ typedef struct global_State {
   void *ud;         /* auxiliary data to 'frealloc' */
   l_mem totalbytes;  /* number of bytes currently allocated - GCdebt */
   l_mem GCdebt;  /* bytes allocated not yet compensated by the collector */
+  l_mem GCdeferred;  /* part of the debt left for 'luaC_idlestep' */
+  l_mem gcidlelimit;  /* deferred debt forcing a regular step (0: no idle mode) */
   lu_mem GCmemtrav;  /* memory traversed by the GC */
   lu_mem GCestimate;  /* an estimate of the non-garbage memory in use */
   stringtable strt;  /* hash table for strings */
+  Shape rootshape;  /* shape with no keys (root of all shapes) */
   TValue l_registry;
   unsigned int seed;  /* randomized seed for hashes */
   lu_byte currentwhite;
   lu_byte gcstate;  /* state of garbage collector */
   lu_byte gckind;  /* kind of GC running */
   lu_byte gcrunning;  /* true if GC is running */
+  lu_byte jitoff;  /* true if compilation to machine code is disabled */
+  lu_byte callstats;  /* true if calls are being counted and timed */
+  lu_ticks ticks0;  /* 'luai_ticks' and 'luaE_nanotime' when the state */
+  double nanos0;  /* was created (to convert ticks to nanoseconds) */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -169,6 +181,7 @@ typedef struct global_State {
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTAGS];  /* metatables for basic types */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
+  lua_GCStats gcstats;  /* collector statistics */
 } global_State;
 
 
@@ -193,6 +206,8 @@ struct lua_State {
   volatile lua_Hook hook;
   ptrdiff_t errfunc;  /* current error handling function (stack index) */
   int stacksize;
+  int stackreserve;  /* stack size kept when shrinking (lua_reservestack) */
+  unsigned short cireserve;  /* number of items kept in 'ci' list */
   int basehookcount;
   int hookcount;
   unsigned short nny;  /* number of non-yieldable calls in stack */
@@ -247,6 +262,8 @@ LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
 LUAI_FUNC CallInfo *luaE_extendCI (lua_State *L);
 LUAI_FUNC void luaE_freeCI (lua_State *L);
 LUAI_FUNC void luaE_shrinkCI (lua_State *L);
+LUAI_FUNC void luaE_reserveCI (lua_State *L);
+LUAI_FUNC double luaE_nanotime (void);
 
 
 #endif
@@ -0,0 +1,235 @@
+/*
+** $Id: lstrbuflib.c $
+** Library for string buffers
+** See Copyright Notice in lua.h
+*/
+
+#define lstrbuflib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+#define LUA_STRBUFHANDLE	"strbuf"
+
+#define MAX_SIZET	((size_t)(~(size_t)0))
+
+/* smallest allocated size */
+#define MINBUFSIZE	64
+
+
+/*
+** A string buffer: 'n' bytes in use out of 'size' allocated at 'b'. The
+** memory comes from the state's allocator and is freed by '__gc'.
+*/
+typedef struct StrBuf {
+  char *b;
+  size_t n;
+  size_t size;
+} StrBuf;
+
+
+#define checkbuf(L,i)	((StrBuf *)luaL_checkudata(L, i, LUA_STRBUFHANDLE))
+
+
+/*
+** makes room for 'sz' more bytes, at least doubling the buffer when it
+** grows, and returns where they go
+*/
+static char *prepbuf (lua_State *L, StrBuf *sb, size_t sz) {
+  if (sb->size - sb->n < sz) {
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    size_t newsize = sb->size * 2;
+    char *newb;
+    if (newsize < MINBUFSIZE) newsize = MINBUFSIZE;
+    if (MAX_SIZET - sz < sb->n)  /* overflow? */
+      luaL_error(L, "string buffer too large");
+    if (newsize - sb->n < sz || newsize < sb->size)  /* not big enough? */
+      newsize = sb->n + sz;
+    newb = (char *)allocf(ud, sb->b, sb->size, newsize);
+    if (newb == NULL)
+      luaL_error(L, "not enough memory");
+    sb->b = newb;
+    sb->size = newsize;
+  }
+  return sb->b + sb->n;
+}
+
+
+static void addlstring (lua_State *L, StrBuf *sb, const char *s, size_t l) {
+  if (l > 0) {
+    memcpy(prepbuf(L, sb, l), s, l);
+    sb->n += l;
+  }
+}
+
+
+/*
+** appends the value at 'arg': strings as they are, numbers as
+** 'tostring' writes them (but without creating that string), and
+** other buffers by their contents
+*/
+static void addvalue (lua_State *L, StrBuf *sb, int arg) {
+  switch (lua_type(L, arg)) {
+    case LUA_TSTRING: {
+      size_t l;
+      const char *s = lua_tolstring(L, arg, &l);
+      addlstring(L, sb, s, l);
+      break;
+    }
+    case LUA_TNUMBER: {
+      char buff[LUA_MAXNUMBER2STR];
+      addlstring(L, sb, buff, lua_numbertobuff(L, arg, buff));
+      break;
+    }
+    default: {
+      StrBuf *other = (StrBuf *)luaL_testudata(L, arg, LUA_STRBUFHANDLE);
+      size_t l;
+      char *p;
+      if (other == NULL)
+        luaL_argerror(L, arg, lua_pushfstring(L,
+            "string, number or strbuf expected, got %s", luaL_typename(L, arg)));
+      l = other->n;
+      p = prepbuf(L, sb, l);  /* may move 'other->b' if 'other' is 'sb' */
+      if (l > 0) memcpy(p, other->b, l);
+      sb->n += l;
+      break;
+    }
+  }
+}
+
+
+/*
+** contents of the buffer at 'idx', or NULL if it is not a buffer; they
+** stay valid until the buffer changes or is collected
+*/
+LUALIB_API const char *luaL_tostrbuf (lua_State *L, int idx, size_t *len) {
+  StrBuf *sb = (StrBuf *)luaL_testudata(L, idx, LUA_STRBUFHANDLE);
+  if (sb == NULL)
+    return NULL;
+  if (len != NULL)
+    *len = sb->n;
+  return (sb->b != NULL) ? sb->b : "";
+}
+
+
+static int sb_new (lua_State *L) {
+  lua_Integer size = luaL_optinteger(L, 1, 0);
+  StrBuf *sb;
+  luaL_argcheck(L, size >= 0, 1, "out of range");
+  sb = (StrBuf *)lua_newuserdata(L, sizeof(StrBuf));
+  sb->b = NULL;
+  sb->n = sb->size = 0;
+  luaL_setmetatable(L, LUA_STRBUFHANDLE);
+  if (size > 0)
+    prepbuf(L, sb, (size_t)size);
+  return 1;
+}
+
+
+static int sb_put (lua_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  int n = lua_gettop(L);
+  int i;
+  for (i = 2; i <= n; i++)
+    addvalue(L, sb, i);
+  lua_settop(L, 1);
+  return 1;  /* return buffer */
+}
+
+
+/*
+** formats with 'string.format' (kept as an upvalue), so the result is
+** the only string created
+*/
+static int sb_putf (lua_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  size_t l;
+  const char *s;
+  luaL_checkstring(L, 2);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_insert(L, 2);  /* call it with the arguments after the buffer */
+  lua_call(L, lua_gettop(L) - 2, 1);
+  s = lua_tolstring(L, -1, &l);
+  addlstring(L, sb, s, l);
+  lua_settop(L, 1);
+  return 1;  /* return buffer */
+}
+
+
+static int sb_reset (lua_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  sb->n = 0;
+  lua_settop(L, 1);
+  return 1;  /* return buffer */
+}
+
+
+static int sb_tostring (lua_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  lua_pushlstring(L, (sb->b != NULL) ? sb->b : "", sb->n);
+  return 1;
+}
+
+
+static int sb_len (lua_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  lua_pushinteger(L, (lua_Integer)sb->n);
+  return 1;
+}
+
+
+static int sb_gc (lua_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  allocf(ud, sb->b, sb->size, 0);
+  sb->b = NULL;
+  sb->n = sb->size = 0;
+  return 0;
+}
+
+
+static const luaL_Reg sblib[] = {
+  {"new", sb_new},
+  {NULL, NULL}
+};
+
+
+/*
+** methods for string buffers
+*/
+static const luaL_Reg sbmeth[] = {
+  {"put", sb_put},
+  {"putf", sb_putf},
+  {"reset", sb_reset},
+  {"tostring", sb_tostring},
+  {"__tostring", sb_tostring},
+  {"__len", sb_len},
+  {"__gc", sb_gc},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_strbuf (lua_State *L) {
+  luaL_newmetatable(L, LUA_STRBUFHANDLE);  /* metatable for buffers */
+  lua_pushvalue(L, -1);  /* push metatable */
+  lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
+  luaL_requiref(L, LUA_STRLIBNAME, luaopen_string, 0);
+  lua_getfield(L, -1, "format");  /* upvalue for 'putf' */
+  lua_remove(L, -2);  /* remove string library */
+  luaL_setfuncs(L, sbmeth, 1);  /* add methods to new metatable */
+  lua_pop(L, 1);  /* pop metatable */
+  luaL_newlib(L, sblib);
+  return 1;
+}
+
@@ -25,15 +25,28 @@
 #define MEMERRMSG       "not enough memory"
 
 
+/* 'shrlen' must tell short strings from long strings in blocks */
+#if LUAI_MAXSHORTLEN >= LSTRBLOCK
+#error "LUAI_MAXSHORTLEN is too large"
+#endif
+
+
 /*
-** Lua will use at most ~(2^LUAI_HASHLIMIT) bytes from a string to
-** compute its hash
+** Lua hashes all bytes of strings shorter than 2^(LUAI_HASHLIMIT + 1)
+** and at most ~(2^LUAI_HASHLIMIT) bytes from longer strings
 */
 #if !defined(LUAI_HASHLIMIT)
 #define LUAI_HASHLIMIT		5
 #endif
 
 
+/*
+** number of buckets split (or merged) by a pending string table resize
+** for each new string
+*/
+#define STRRESIZESTEP	2
+
+
 /*
 ** equality for long strings
 */
@@ -42,19 +55,104 @@ int luaS_eqlngstr (TString *a, TString *b) {
   lua_assert(a->tt == LUA_TLNGSTR && b->tt == LUA_TLNGSTR);
   return (a == b) ||  /* same instance or... */
     ((len == b->u.lnglen) &&  /* equal length and ... */
+     !(a->extra && b->extra && a->hash != b->hash) &&  /* no hash says no */
      (memcmp(getstr(a), getstr(b), len) == 0));  /* equal contents */
 }
 
 
-unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+/*
+** Hashes short strings a word at a time
+*/
+static unsigned int wordhash (const char *str, size_t l, unsigned int seed) {
   unsigned int h = seed ^ cast(unsigned int, l);
-  size_t step = (l >> LUAI_HASHLIMIT) + 1;
-  for (; l >= step; l -= step)
-    h ^= ((h<<5) + (h>>2) + cast_byte(str[l - 1]));
+  unsigned int w;
+  for (; l >= sizeof(w); l -= sizeof(w), str += sizeof(w)) {
+    memcpy(&w, str, sizeof(w));
+    h = (h ^ w) * 0x9E3779B1u;
+    h ^= h >> 15;
+  }
+  for (; l > 0; l--) {
+    h = (h ^ cast_byte(str[l - 1])) * 0x9E3779B1u;
+    h ^= h >> 15;
+  }
   return h;
 }
 
 
+#if defined(LUA_USE_SIMD)
+
+#include <nmmintrin.h>
+
+static int hascrc32;  /* CPU has SSE4.2? (set by 'luaS_init') */
+
+
+/*
+** Packs the last 'l' (< 8) bytes of a string into a word. 4 to 7 bytes
+** are read as two overlapping 4-byte words; the length is already part
+** of the hash, so that loses nothing.
+*/
+static size_t tailword (const char *s, size_t l) {
+  if (l >= 4) {
+    unsigned int a, b;
+    memcpy(&a, s, 4);
+    memcpy(&b, s + l - 4, 4);
+    return (cast(size_t, b) << 32) | a;
+  }
+  else if (l > 0)
+    return cast_byte(s[0]) | (cast(size_t, cast_byte(s[l >> 1])) << 8) |
+           (cast(size_t, cast_byte(s[l - 1])) << 16);
+  else return 0;
+}
+
+
+/*
+** CRC32 is affine in its input: two strings of equal length collide
+** under every seed if they collide under one. So each word is first
+** mixed with a key made from the seed, through a multiplication of its
+** halves (which is not linear); the result depends on the seed in ways
+** an attacker cannot predict.
+*/
+#define keyword(w,k)	((((w) ^ (k)) & 0xFFFFFFFFu) * (((w) ^ (k)) >> 32) + (w))
+
+
+/*
+** Same as 'wordhash', 8 bytes per 'crc32' instruction
+*/
+__attribute__((target("sse4.2")))
+static unsigned int crchash (const char *str, size_t l, unsigned int seed) {
+  size_t k = cast(size_t, seed) * 0x9E3779B97F4A7C15u;  /* spread seed */
+  size_t h = seed ^ l;
+  size_t w;
+  for (; l >= 8; l -= 8, str += 8) {
+    memcpy(&w, str, 8);
+    h = _mm_crc32_u64(h, keyword(w, k));
+  }
+  w = tailword(str, l);
+  h = _mm_crc32_u64(h, keyword(w, k)) * 0x9E3779B1u;
+  return cast(unsigned int, h ^ (h >> 16));
+}
+
+#endif
+
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  if ((l >> LUAI_HASHLIMIT) <= 1) {  /* hash all bytes? */
+#if defined(LUA_USE_SIMD)
+    if (hascrc32)
+      return crchash(str, l, seed);
+#endif
+    return wordhash(str, l, seed);
+  }
+  else {
+    unsigned int h = seed ^ cast(unsigned int, l);
+    size_t step = (l >> LUAI_HASHLIMIT) + 1;
+    for (; l >= step; l -= step)
+      h ^= ((h<<5) + (h>>2) + cast_byte(str[l - 1]));
+    return h;
+  }
+}
+
+
 unsigned int luaS_hashlongstr (TString *ts) {
   lua_assert(ts->tt == LUA_TLNGSTR);
   if (ts->extra == 0) {  /* no hash? */
@@ -66,33 +164,86 @@ unsigned int luaS_hashlongstr (TString *ts) {
 
 
 /*
-** resizes the string table
+** Resizes the string table. Strings are not rehashed here: as sizes are
+** powers of 2, growing splits each old bucket 'i' into buckets 'i' and
+** 'i + oldsize', and shrinking merges bucket 'i + size' into bucket 'i'.
+** 'luaS_resizestep' does that a few buckets at a time, so that neither
+** a string creation nor a collector step pays for all strings.
 */
 void luaS_resize (lua_State *L, int newsize) {
   int i;
   stringtable *tb = &G(L)->strt;
+  if (tb->oldsize != 0)  /* previous resize not finished? */
+    luaS_resizestep(L, MAX_INT);  /* finish it */
   if (newsize > tb->size) {  /* grow table if needed */
     luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
     for (i = tb->size; i < newsize; i++)
       tb->hash[i] = NULL;
   }
-  for (i = 0; i < tb->size; i++) {  /* rehash */
-    TString *p = tb->hash[i];
-    tb->hash[i] = NULL;
-    while (p) {  /* for each node in the list */
-      TString *hnext = p->u.hnext;  /* save next */
-      unsigned int h = lmod(p->hash, newsize);  /* new position */
-      p->u.hnext = tb->hash[h];  /* chain it */
-      tb->hash[h] = p;
-      p = hnext;
+  tb->oldsize = tb->size;  /* (0 for the initial table: nothing to do) */
+  tb->oldpos = 0;
+  tb->size = newsize;
+}
+
+
+static void movelist (stringtable *tb, TString *p) {
+  while (p) {  /* for each node in the list */
+    TString *hnext = p->u.hnext;  /* save next */
+    unsigned int h = lmod(p->hash, tb->size);  /* new position */
+    p->u.hnext = tb->hash[h];  /* chain it */
+    tb->hash[h] = p;
+    p = hnext;
+  }
+}
+
+
+/*
+** splits (or merges) up to 'n' buckets of a pending resize
+*/
+void luaS_resizestep (lua_State *L, int n) {
+  stringtable *tb = &G(L)->strt;
+  if (tb->oldsize == 0)  /* no resize in progress? */
+    return;
+  if (tb->size > tb->oldsize) {  /* growing? */
+    for (; n > 0 && tb->oldpos < tb->oldsize; n--) {
+      TString *p = tb->hash[tb->oldpos];
+      tb->hash[tb->oldpos++] = NULL;
+      movelist(tb, p);
     }
+    if (tb->oldpos < tb->oldsize)
+      return;  /* not done yet */
   }
-  if (newsize < tb->size) {  /* shrink table if needed */
-    /* vanishing slice should be empty */
-    lua_assert(tb->hash[newsize] == NULL && tb->hash[tb->size - 1] == NULL);
-    luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
+  else {  /* shrinking */
+    for (; n > 0 && tb->oldpos < tb->oldsize - tb->size; n--) {
+      int i = tb->size + tb->oldpos++;
+      TString *p = tb->hash[i];
+      tb->hash[i] = NULL;
+      movelist(tb, p);
+    }
+    if (tb->oldpos < tb->oldsize - tb->size)
+      return;  /* not done yet */
+    /* vanishing slice is empty */
+    luaM_reallocvector(L, tb->hash, tb->oldsize, tb->size, TString *);
   }
-  tb->size = newsize;
+  tb->oldsize = tb->oldpos = 0;
+}
+
+
+/*
+** returns the bucket for a string with hash 'h'. While the table is
+** being resized, buckets not yet split (or merged) are used as they
+** were. (When shrinking, 'i - size' is negative for buckets that do
+** not move.)
+*/
+static TString **getbucket (stringtable *tb, unsigned int h) {
+  if (tb->oldsize != 0) {  /* resize in progress? */
+    int i = lmod(h, tb->oldsize);
+    int done = (tb->size > tb->oldsize) ? (i < tb->oldpos)
+                                        : (i - tb->size < tb->oldpos);
+    if (!done)
+      return &tb->hash[i];
+  }
+  return &tb->hash[lmod(h, tb->size)];
 }
 
 
@@ -116,6 +267,9 @@ void luaS_clearcache (global_State *g) {
 void luaS_init (lua_State *L) {
   global_State *g = G(L);
   int i, j;
+#if defined(LUA_USE_SIMD)
+  hascrc32 = __builtin_cpu_supports("sse4.2");  /* same for every state */
+#endif
   luaS_resize(L, MINSTRTABSIZE);  /* initial size of string table */
   /* pre-create memory-error message */
   g->memerrmsg = luaS_newliteral(L, MEMERRMSG);
@@ -139,6 +293,7 @@ static TString *createstrobj (lua_State *L, size_t l, int tag, unsigned int h) {
   ts = gco2ts(o);
   ts->hash = h;
   ts->extra = 0;
+  ts->shrlen = LSTRPLAIN;
   getstr(ts)[l] = '\0';  /* ending 0 */
   return ts;
 }
@@ -151,9 +306,128 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
 }
 
 
+/*
+** {======================================================
+** String blocks
+** =======================================================
+*/
+
+/* size of a block with room for 'n' bytes */
+#define sizeblock(n)	(offsetof(StrBlock, data) + ((n) + 1) * sizeof(char))
+
+
+static StrBlock *newblock (lua_State *L, size_t size) {
+  StrBlock *b = cast(StrBlock *, luaM_malloc(L, sizeblock(size)));
+  b->nref = 1;
+  b->used = 0;
+  b->size = size;
+  b->fixed = 0;
+  return b;
+}
+
+
+static void releaseblock (lua_State *L, StrBlock *b) {
+  if (--b->nref == 0)
+    luaM_freemem(L, b, sizeblock(b->size));
+}
+
+
+/*
+** Creates a long string with length 'l' whose bytes will be in a
+** block. The block is set by the caller.
+*/
+static TString *newblockstr (lua_State *L, size_t l) {
+  GCObject *o = luaC_newobj(L, LUA_TLNGSTR,
+                            sizeof(UTString) + sizeof(StrBlock *));
+  TString *ts = gco2ts(o);
+  ts->hash = G(L)->seed;
+  ts->extra = 0;
+  ts->shrlen = LSTRBLOCK;
+  ts->u.lnglen = l;
+  getblock(ts) = NULL;  /* no block yet */
+  return ts;
+}
+
+
+/*
+** Creates a long string with length 'l' that starts with the bytes of
+** long string 's'; the caller fills in the other bytes. When 's' is the
+** longest string of a block with enough room, the new string only
+** extends the block. Otherwise, if 's' is itself the result of a
+** concatenation, it is probably being built by repeated appends, so
+** the new string gets a block with room to grow. Both ways keep the
+** cost of a sequence of appends linear.
+*/
+TString *luaS_extend (lua_State *L, TString *s, size_t l) {
+  size_t sl = s->u.lnglen;
+  TString *ts;
+  StrBlock *b;
+  lua_assert(s->tt == LUA_TLNGSTR && sl < l);
+  if (s->shrlen == LSTRBLOCK && (b = getblock(s))->used == sl &&
+      !b->fixed && l <= b->size) {  /* can grow in place? */
+    ts = newblockstr(L, l);
+    getblock(ts) = b;
+    b->nref++;
+  }
+  else if (s->shrlen == LSTRPLAIN) {  /* first append: plain copy */
+    ts = luaS_createlngstrobj(L, l);
+    ts->shrlen = LSTRCAT;
+    memcpy(getstr(ts), getstr(s), sl * sizeof(char));
+    return ts;
+  }
+  else {  /* new block, 50% larger than needed */
+    size_t size = (l < MAX_SIZE / 3) ? l + l / 2 : l;
+    ts = newblockstr(L, l);
+    setsvalue2s(L, L->top, ts);  /* anchor it (there is EXTRA_STACK) */
+    L->top++;
+    b = newblock(L, size);
+    L->top--;
+    getblock(ts) = b;
+    memcpy(b->data, getstr(s), sl * sizeof(char));
+  }
+  b->used = l;
+  b->data[l] = '\0';
+  return ts;
+}
+
+
+/*
+** Returns the bytes of a string as a C string. A string sharing a block
+** with longer ones is not followed by a '\0', so it gets a block of
+** its own. The longest string of a block cannot grow in place anymore,
+** as the caller may keep the pointer.
+*/
+const char *luaS_tocstr (lua_State *L, TString *ts) {
+  if (ts->shrlen == LSTRBLOCK) {  /* (short strings never have this) */
+    StrBlock *b = getblock(ts);
+    size_t l = ts->u.lnglen;
+    if (l == b->used)
+      b->fixed = 1;
+    else if (b->data[l] != '\0') {
+      StrBlock *nb = newblock(L, l);
+      memcpy(nb->data, b->data, l * sizeof(char));
+      nb->data[l] = '\0';
+      nb->used = l;
+      getblock(ts) = nb;
+      releaseblock(L, b);
+    }
+  }
+  return getstr(ts);
+}
+
+
+void luaS_freelngstr (lua_State *L, TString *ts) {
+  if (ts->shrlen == LSTRBLOCK && getblock(ts) != NULL)
+    releaseblock(L, getblock(ts));
+  luaM_freemem(L, ts, sizelngstr(ts));
+}
+
+/* }====================================================== */
+
+
 void luaS_remove (lua_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
-  TString **p = &tb->hash[lmod(ts->hash, tb->size)];
+  TString **p = getbucket(tb, ts->hash);
   while (*p != ts)  /* find previous element */
     p = &(*p)->u.hnext;
   *p = (*p)->u.hnext;  /* remove element from its list */
@@ -168,7 +442,7 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   TString *ts;
   global_State *g = G(L);
   unsigned int h = luaS_hash(str, l, g->seed);
-  TString **list = &g->strt.hash[lmod(h, g->strt.size)];
+  TString **list = getbucket(&g->strt, h);
   lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
   for (ts = *list; ts != NULL; ts = ts->u.hnext) {
     if (l == ts->shrlen &&
@@ -179,10 +453,10 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
       return ts;
     }
   }
-  if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT/2) {
+  luaS_resizestep(L, STRRESIZESTEP);
+  if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT/2)
     luaS_resize(L, g->strt.size * 2);
-    list = &g->strt.hash[lmod(h, g->strt.size)];  /* recompute with new size */
-  }
+  list = getbucket(&g->strt, h);  /* recompute after moving buckets */
   ts = createstrobj(L, l, LUA_TSHRSTR, h);
   memcpy(getstr(ts), str, l * sizeof(char));
   ts->shrlen = cast_byte(l);
@@ -14,6 +14,11 @@
 
 #define sizelstring(l)  (sizeof(union UTString) + ((l) + 1) * sizeof(char))
 
+/* size of a long string object (without its block) */
+#define sizelngstr(ts)  ((ts)->shrlen == LSTRBLOCK \
+	? sizeof(union UTString) + sizeof(StrBlock *) \
+	: sizelstring((ts)->u.lnglen))
+
 #define sizeludata(l)	(sizeof(union UUdata) + (l))
 #define sizeudata(u)	sizeludata((u)->len)
 
@@ -37,6 +42,7 @@ LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l, unsigned int seed);
 LUAI_FUNC unsigned int luaS_hashlongstr (TString *ts);
 LUAI_FUNC int luaS_eqlngstr (TString *a, TString *b);
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
+LUAI_FUNC void luaS_resizestep (lua_State *L, int n);
 LUAI_FUNC void luaS_clearcache (global_State *g);
 LUAI_FUNC void luaS_init (lua_State *L);
 LUAI_FUNC void luaS_remove (lua_State *L, TString *ts);
@@ -44,6 +50,9 @@ LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
 LUAI_FUNC TString *luaS_new (lua_State *L, const char *str);
 LUAI_FUNC TString *luaS_createlngstrobj (lua_State *L, size_t l);
+LUAI_FUNC TString *luaS_extend (lua_State *L, TString *s, size_t l);
+LUAI_FUNC const char *luaS_tocstr (lua_State *L, TString *ts);
+LUAI_FUNC void luaS_freelngstr (lua_State *L, TString *ts);
 
 
 #endif
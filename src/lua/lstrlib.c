@@ -200,6 +200,72 @@ static int str_dump (lua_State *L) {
 
 
 
+/*
+** {======================================================
+** CACHES
+** =======================================================
+*/
+
+/*
+** Compiled patterns and formats are kept in tables in the registry,
+** indexed by the pattern or format string (entry 0 counts the others).
+** Indexing by a short string is a pointer comparison, and the table
+** keeps the strings alive. A cache that fills up is emptied.
+*/
+
+/* maximum number of entries in a cache */
+#if !defined(MAXSTRCACHE)
+#define MAXSTRCACHE	64
+#endif
+
+
+/*
+** Looks for the string at 'arg' in the cache with registry key 'key'.
+** If it is there, pushes its entry and returns 1; otherwise pushes the
+** cache (for 'addtocache') and returns 0.
+*/
+static int findincache (lua_State *L, const void *key, int arg) {
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, key) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_createtable(L, 0, MAXSTRCACHE);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, key);
+  }
+  lua_pushvalue(L, arg);
+  if (lua_rawget(L, -2) != LUA_TNIL) {  /* already there? */
+    lua_remove(L, -2);  /* remove cache */
+    return 1;
+  }
+  lua_pop(L, 1);
+  return 0;
+}
+
+
+/*
+** Adds the value on the top as the entry for the string at 'arg' in
+** the cache below it, and removes the cache.
+*/
+static void addtocache (lua_State *L, int arg) {
+  lua_Integer count;
+  lua_rawgeti(L, -2, 0);  /* number of entries */
+  count = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  if (count >= MAXSTRCACHE) {  /* cache is full? */
+    lua_cleartable(L, -2);  /* start over */
+    count = 0;
+  }
+  lua_pushinteger(L, count + 1);
+  lua_rawseti(L, -3, 0);
+  lua_pushvalue(L, arg);
+  lua_pushvalue(L, -2);
+  lua_rawset(L, -4);  /* cache[string] = value */
+  lua_remove(L, -2);  /* remove cache */
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** PATTERN MATCHING
@@ -525,12 +591,86 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
+#if defined(LUA_USE_SIMD)
+
+#include <immintrin.h>
+
+static int hasavx2;  /* CPU has AVX2? (set by 'luaopen_string') */
+
+static const char *lmemfind (const char *s1, size_t l1,
+                               const char *s2, size_t l2);
+
+
+/*
+** number of false candidates found by 'memchr' before 'lmemfind'
+** switches to the vector search
+*/
+#define FINDMISSES	4
+
+
+/*
+** Plain search for patterns with at least 2 chars. Compares the first
+** and the last char of 's2' against 16 candidate positions of 's1' at a
+** time; only positions where both match compare the rest of 's2'. The
+** last (less than 16) candidates are left to the scalar code.
+*/
+static const char *find16 (const char *s1, size_t l1,
+                           const char *s2, size_t l2) {
+  const __m128i first = _mm_set1_epi8(s2[0]);
+  const __m128i last = _mm_set1_epi8(s2[l2 - 1]);
+  const char *lim = s1 + (l1 - l2 + 1);  /* after last candidate */
+  for (; lim - s1 >= 16; s1 += 16) {
+    __m128i f = _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *)s1));
+    __m128i l = _mm_cmpeq_epi8(last,
+                    _mm_loadu_si128((const __m128i *)(s1 + l2 - 1)));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(f, l));
+    for (; mask != 0; mask &= mask - 1) {
+      const char *c = s1 + __builtin_ctz(mask);
+      if (memcmp(c + 1, s2 + 1, l2 - 2) == 0)
+        return c;
+    }
+  }
+  return lmemfind(s1, (size_t)(lim - s1) + l2 - 1, s2, l2);
+}
+
+
+/*
+** Same as 'find16', with 32 candidates at a time
+*/
+__attribute__((target("avx2")))
+static const char *find32 (const char *s1, size_t l1,
+                           const char *s2, size_t l2) {
+  const __m256i first = _mm256_set1_epi8(s2[0]);
+  const __m256i last = _mm256_set1_epi8(s2[l2 - 1]);
+  const char *lim = s1 + (l1 - l2 + 1);  /* after last candidate */
+  for (; lim - s1 >= 32; s1 += 32) {
+    __m256i f = _mm256_cmpeq_epi8(first,
+                    _mm256_loadu_si256((const __m256i *)s1));
+    __m256i l = _mm256_cmpeq_epi8(last,
+                    _mm256_loadu_si256((const __m256i *)(s1 + l2 - 1)));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+                                      _mm256_and_si256(f, l));
+    for (; mask != 0; mask &= mask - 1) {
+      const char *c = s1 + __builtin_ctz(mask);
+      if (memcmp(c + 1, s2 + 1, l2 - 2) == 0)
+        return c;
+    }
+  }
+  return find16(s1, (size_t)(lim - s1) + l2 - 1, s2, l2);
+}
+
+#endif
+
+
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
   else {
     const char *init;  /* to search for a '*s2' inside 's1' */
+#if defined(LUA_USE_SIMD)
+    int misses = 0;
+#endif
     l2--;  /* 1st char will be checked by 'memchr' */
     l1 = l1-l2;  /* 's2' cannot be found after that */
     while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
@@ -540,6 +680,12 @@ static const char *lmemfind (const char *s1, size_t l1,
       else {  /* correct 'l1' and 's1' to try again */
         l1 -= init-s1;
         s1 = init;
+#if defined(LUA_USE_SIMD)
+        /* 1st char is common? check 1st and last chars together */
+        if (++misses == FINDMISSES && l2 > 0 && l1 >= 16)
+          return (hasavx2) ? find32(s1, l1 + l2, s2, l2 + 1)
+                           : find16(s1, l1 + l2, s2, l2 + 1);
+#endif
       }
     }
     return NULL;  /* not found */
@@ -604,6 +750,518 @@ static void reprepstate (MatchState *ms) {
 }
 
 
+/*
+** {======================================================
+** Compiled patterns
+** =======================================================
+*/
+
+/*
+** Patterns are compiled into a list of items, one per pattern element,
+** where char classes become bitmaps. The matcher below follows 'match'
+** step by step (same recursion, same limits), so both give the same
+** results. Patterns that would raise an error when matched (or that are
+** too long) are not compiled and keep using 'match', so that errors
+** happen as before. Compiled patterns are cached (see 'findincache');
+** as classes such as '%a' depend on the locale, a cached pattern that
+** uses them keeps the name of its LC_CTYPE locale (as user value) and
+** is compiled again when that changes.
+*/
+
+/* kinds of pattern items */
+#define PI_ACCEPT	0	/* end of pattern */
+#define PI_CLASS	1	/* char class with optional suffix */
+#define PI_OPEN		2	/* '(' */
+#define PI_POSITION	3	/* '()' */
+#define PI_CLOSE	4	/* ')' */
+#define PI_END		5	/* final '$' */
+#define PI_BALANCE	6	/* '%bxy' */
+#define PI_FRONTIER	7	/* '%f[set]' */
+#define PI_BACKREF	8	/* '%1' to '%9' */
+
+
+/* maximum number of items in a compiled pattern */
+#if !defined(MAXPATTITEMS)
+#define MAXPATTITEMS	64
+#endif
+
+/* maximum size of the literal prefix of a compiled pattern */
+#define MAXPREFIX	16
+
+
+typedef struct PattItem {
+  unsigned char kind;
+  unsigned char suffix;  /* '*', '+', '-', '?' or 0 (PI_CLASS) */
+  unsigned char arg[2];  /* delimiters ('%b') or capture number ('%1') */
+  unsigned char set[32];  /* chars in class (PI_CLASS, PI_FRONTIER) */
+} PattItem;
+
+
+typedef struct Pattern {
+  int first;  /* first char of all matches (-1 if unknown) */
+  size_t lprefix;  /* length of 'prefix' */
+  char prefix[MAXPREFIX];  /* literal text starting all matches */
+  unsigned char firstset[32];  /* first chars of all matches */
+  int hasfirstset;  /* whether 'firstset' is known */
+  int ctype;  /* whether its sets depend on the locale */
+  PattItem items[1];  /* ending with a PI_ACCEPT item */
+} Pattern;
+
+
+#define inset(set,c)	((set)[(c) >> 3] & (1u << ((c) & 7)))
+
+
+/* key of the pattern cache in the registry */
+static const int PATTCACHE = 0;
+
+
+/*
+** same as 'classend', but returns NULL for malformed classes instead
+** of raising an error
+*/
+static const char *classlimit (const char *p, const char *p_end) {
+  switch (*p++) {
+    case L_ESC:
+      return (p == p_end) ? NULL : p + 1;
+    case '[': {
+      if (*p == '^') p++;
+      do {  /* look for a ']' */
+        if (p == p_end)
+          return NULL;
+        if (*(p++) == L_ESC && p < p_end)
+          p++;  /* skip escapes (e.g. '%]') */
+      } while (*p != ']');
+      return p + 1;
+    }
+    default:
+      return p;
+  }
+}
+
+
+/*
+** fills 'set' with the chars matched by the class at 'p' (ending at
+** 'ep'); returns whether they depend on the locale ('%d' and '%x' do
+** not)
+*/
+static int classset (unsigned char *set, const char *p, const char *ep) {
+  const char *q;
+  int ctype = 0;
+  int c;
+  for (q = p; q < ep - 1; q++) {
+    if (*q == L_ESC) {
+      q++;
+      if (*q != '\0' && strchr("acglpsuwACGLPSUW", *q) != NULL)
+        ctype = 1;
+    }
+  }
+  memset(set, 0, 32);
+  for (c = 0; c <= UCHAR_MAX; c++) {
+    int res;
+    switch (*p) {
+      case '.': res = 1; break;
+      case L_ESC: res = match_class(c, uchar(*(p + 1))); break;
+      case '[': res = matchbracketclass(c, p, ep - 1); break;
+      default: res = (uchar(*p) == c); break;
+    }
+    if (res)
+      set[c >> 3] |= (unsigned char)(1u << (c & 7));
+  }
+  return ctype;
+}
+
+
+/* if 'set' has a single char, returns it; otherwise returns -1 */
+static int singlechar (const unsigned char *set) {
+  int c = -1;
+  int i;
+  for (i = 0; i <= UCHAR_MAX; i++) {
+    if (inset(set, i)) {
+      if (c >= 0) return -1;
+      c = i;
+    }
+  }
+  return c;
+}
+
+
+/*
+** Compiles pattern 'p' (without its anchor) into 'items'. Returns the
+** number of items, or 0 when the pattern must be left to 'match'; sets
+** '*ctype' if the items depend on the locale.
+*/
+static int compilepattern (PattItem *items, const char *p, size_t lp,
+                           int *ctype) {
+  const char *p_end = p + lp;
+  int n = 0;
+  int level = 0;  /* number of captures */
+  int closed[LUA_MAXCAPTURES];  /* whether each capture is closed */
+  *ctype = 0;
+  while (p != p_end) {
+    PattItem *pi = &items[n];
+    if (n == MAXPATTITEMS - 1)
+      return 0;  /* too long */
+    pi->suffix = 0;
+    switch (*p) {
+      case '(': {
+        if (level == LUA_MAXCAPTURES) return 0;
+        if (*(p + 1) == ')') {  /* position capture? */
+          pi->kind = PI_POSITION;
+          closed[level++] = 1;
+          p += 2;
+        }
+        else {
+          pi->kind = PI_OPEN;
+          closed[level++] = 0;
+          p++;
+        }
+        n++;
+        continue;
+      }
+      case ')': {
+        int l = level - 1;
+        while (l >= 0 && closed[l]) l--;  /* as in 'capture_to_close' */
+        if (l < 0) return 0;
+        closed[l] = 1;
+        pi->kind = PI_CLOSE;
+        n++; p++;
+        continue;
+      }
+      case '$': {
+        if ((p + 1) != p_end)  /* not the last char? */
+          break;  /* a plain char */
+        pi->kind = PI_END;
+        n++; p++;
+        continue;
+      }
+      case L_ESC: {
+        switch (*(p + 1)) {
+          case 'b': {
+            if (p + 2 >= p_end - 1) return 0;  /* missing arguments */
+            pi->kind = PI_BALANCE;
+            pi->arg[0] = uchar(*(p + 2));
+            pi->arg[1] = uchar(*(p + 3));
+            n++; p += 4;
+            continue;
+          }
+          case 'f': {
+            const char *ep;
+            p += 2;
+            if (*p != '[' || (ep = classlimit(p, p_end)) == NULL)
+              return 0;
+            pi->kind = PI_FRONTIER;
+            *ctype |= classset(pi->set, p, ep);
+            n++; p = ep;
+            continue;
+          }
+          case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7':
+          case '8': case '9': {
+            int l = uchar(*(p + 1)) - '1';
+            if (l < 0 || l >= level || !closed[l])  /* invalid capture? */
+              return 0;
+            pi->kind = PI_BACKREF;
+            pi->arg[0] = uchar(*(p + 1));
+            n++; p += 2;
+            continue;
+          }
+          default: break;
+        }
+        break;
+      }
+      default: break;
+    }
+    {  /* pattern class plus optional suffix */
+      const char *ep = classlimit(p, p_end);
+      if (ep == NULL) return 0;
+      pi->kind = PI_CLASS;
+      *ctype |= classset(pi->set, p, ep);
+      if (ep < p_end && (*ep == '*' || *ep == '+' || *ep == '-' ||
+                         *ep == '?'))
+        pi->suffix = uchar(*ep++);
+      n++; p = ep;
+    }
+  }
+  items[n++].kind = PI_ACCEPT;
+  return n;
+}
+
+
+/*
+** Finds what starts every match of 'pt': a literal prefix, a first
+** char or a set of first chars. Captures and '()' do not consume chars
+** and are skipped.
+*/
+static void findprefix (Pattern *pt) {
+  const PattItem *pi = pt->items;
+  pt->first = -1;
+  pt->lprefix = 0;
+  pt->hasfirstset = 0;
+  while (pi->kind == PI_OPEN || pi->kind == PI_POSITION)
+    pi++;
+  if (pi->kind == PI_BALANCE && pi->arg[0] != '\0')
+    pt->first = pi->arg[0];
+  else if (pi->kind == PI_CLASS && (pi->suffix == 0 || pi->suffix == '+')) {
+    memcpy(pt->firstset, pi->set, sizeof(pt->firstset));
+    pt->hasfirstset = 1;
+    pt->first = singlechar(pi->set);
+    for (; pt->lprefix < MAXPREFIX; pi++) {
+      int c;
+      if (pi->kind == PI_OPEN || pi->kind == PI_POSITION ||
+          pi->kind == PI_CLOSE)
+        continue;
+      if (pi->kind != PI_CLASS || (pi->suffix != 0 && pi->suffix != '+') ||
+          (c = singlechar(pi->set)) < 0)
+        break;
+      pt->prefix[pt->lprefix++] = (char)c;
+      if (pi->suffix == '+')  /* what follows may be more of it */
+        break;
+    }
+  }
+}
+
+
+/*
+** whether the compiled pattern on the top was compiled in the current
+** LC_CTYPE locale
+*/
+static int samelocale (lua_State *L) {
+  const char *locale = setlocale(LC_CTYPE, NULL);
+  int res;
+  lua_getuservalue(L, -1);
+  res = (locale != NULL && strcmp(lua_tostring(L, -1), locale) == 0);
+  lua_pop(L, 1);
+  return res;
+}
+
+
+/*
+** Pushes the compiled form of the pattern at 'arg' (compiling and
+** caching it if needed), or 'false' if it is left to 'match'. The
+** caller keeps that value in the stack while it uses the pattern, as
+** the cache may be emptied at any time.
+*/
+static const Pattern *getpattern (lua_State *L, int arg, int anchor) {
+  size_t lp;
+  const char *p = lua_tolstring(L, arg, &lp);
+  PattItem items[MAXPATTITEMS];
+  Pattern *pt;
+  int n, ctype;
+  if (findincache(L, &PATTCACHE, arg)) {
+    pt = (Pattern *)lua_touserdata(L, -1);  /* NULL for 'false' */
+    if (pt == NULL || !pt->ctype || samelocale(L))
+      return pt;
+    lua_pop(L, 1);  /* locale has changed; compile it again */
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &PATTCACHE);
+  }
+  n = compilepattern(items, p + anchor, lp - anchor, &ctype);
+  if (n == 0) {
+    pt = NULL;
+    lua_pushboolean(L, 0);
+  }
+  else {
+    pt = (Pattern *)lua_newuserdata(L, sizeof(Pattern) +
+                                       (n - 1) * sizeof(PattItem));
+    memcpy(pt->items, items, n * sizeof(PattItem));
+    findprefix(pt);
+    pt->ctype = ctype;
+    if (ctype) {  /* keep its locale */
+      const char *locale = setlocale(LC_CTYPE, NULL);
+      lua_pushstring(L, (locale != NULL) ? locale : "");
+      lua_setuservalue(L, -2);
+    }
+  }
+  addtocache(L, arg);
+  return pt;
+}
+
+
+/*
+** Returns the first position in [s, e) where a match of 'pt' may start,
+** or NULL if there is none. Patterns that can match the empty string
+** ('first' and 'firstset' unknown) can start anywhere.
+*/
+static const char *nextstart (const Pattern *pt, const char *s,
+                                                  const char *e) {
+  if (pt->lprefix > 1)
+    return lmemfind(s, e - s, pt->prefix, pt->lprefix);
+  else if (pt->first >= 0)
+    return (const char *)memchr(s, pt->first, e - s);
+  else if (pt->hasfirstset) {
+    for (; s < e; s++) {
+      if (inset(pt->firstset, uchar(*s)))
+        return s;
+    }
+    return NULL;
+  }
+  else
+    return s;
+}
+
+
+static const char *pmatch (MatchState *ms, const char *s,
+                                           const PattItem *pi);
+
+
+static int psinglematch (MatchState *ms, const char *s,
+                                         const PattItem *pi) {
+  return (s < ms->src_end && inset(pi->set, uchar(*s)));
+}
+
+
+static const char *pmax_expand (MatchState *ms, const char *s,
+                                                const PattItem *pi) {
+  ptrdiff_t i = 0;  /* counts maximum expand for item */
+  while (psinglematch(ms, s + i, pi))
+    i++;
+  /* keeps trying to match with the maximum repetitions */
+  while (i>=0) {
+    const char *res = pmatch(ms, (s+i), pi + 1);
+    if (res) return res;
+    i--;  /* else didn't match; reduce 1 repetition to try again */
+  }
+  return NULL;
+}
+
+
+static const char *pmin_expand (MatchState *ms, const char *s,
+                                                const PattItem *pi) {
+  for (;;) {
+    const char *res = pmatch(ms, s, pi + 1);
+    if (res != NULL)
+      return res;
+    else if (psinglematch(ms, s, pi))
+      s++;  /* try with one more repetition */
+    else return NULL;
+  }
+}
+
+
+static const char *pstart_capture (MatchState *ms, const char *s,
+                                   const PattItem *pi, int what) {
+  const char *res;
+  int level = ms->level;
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=pmatch(ms, s, pi)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *pend_capture (MatchState *ms, const char *s,
+                                 const PattItem *pi) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = pmatch(ms, s, pi)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+/* 'match' for compiled patterns */
+static const char *pmatch (MatchState *ms, const char *s,
+                                           const PattItem *pi) {
+  if (ms->matchdepth-- == 0)
+    luaL_error(ms->L, "pattern too complex");
+  init: /* using goto's to optimize tail recursion */
+  switch (pi->kind) {
+    case PI_ACCEPT:
+      break;
+    case PI_OPEN:
+      s = pstart_capture(ms, s, pi + 1, CAP_UNFINISHED);
+      break;
+    case PI_POSITION:
+      s = pstart_capture(ms, s, pi + 1, CAP_POSITION);
+      break;
+    case PI_CLOSE:
+      s = pend_capture(ms, s, pi + 1);
+      break;
+    case PI_END:
+      s = (s == ms->src_end) ? s : NULL;  /* check end of string */
+      break;
+    case PI_BALANCE: {
+      int cont = 1;
+      if (uchar(*s) != pi->arg[0]) {
+        s = NULL;
+        break;
+      }
+      while (++s < ms->src_end) {
+        if (uchar(*s) == pi->arg[1]) {
+          if (--cont == 0) {
+            s++; pi++; goto init;  /* return pmatch(ms, s + 1, pi + 1); */
+          }
+        }
+        else if (uchar(*s) == pi->arg[0]) cont++;
+      }
+      s = NULL;  /* string ends out of balance */
+      break;
+    }
+    case PI_FRONTIER: {
+      unsigned char previous = (s == ms->src_init) ? '\0' : uchar(*(s - 1));
+      if (!inset(pi->set, previous) && inset(pi->set, uchar(*s))) {
+        pi++; goto init;  /* return pmatch(ms, s, pi + 1); */
+      }
+      s = NULL;  /* match failed */
+      break;
+    }
+    case PI_BACKREF: {
+      s = match_capture(ms, s, pi->arg[0]);
+      if (s != NULL) {
+        pi++; goto init;  /* return pmatch(ms, s, pi + 1); */
+      }
+      break;
+    }
+    default: {  /* PI_CLASS */
+      /* does not match at least once? */
+      if (!psinglematch(ms, s, pi)) {
+        if (pi->suffix == '*' || pi->suffix == '?' || pi->suffix == '-') {
+          pi++; goto init;  /* return pmatch(ms, s, pi + 1); */
+        }
+        else  /* '+' or no suffix */
+          s = NULL;  /* fail */
+      }
+      else {  /* matched once */
+        switch (pi->suffix) {  /* handle optional suffix */
+          case '?': {  /* optional */
+            const char *res;
+            if ((res = pmatch(ms, s + 1, pi + 1)) != NULL)
+              s = res;
+            else {
+              pi++; goto init;  /* else return pmatch(ms, s, pi + 1); */
+            }
+            break;
+          }
+          case '+':  /* 1 or more repetitions */
+            s++;  /* 1 match already done */
+            /* FALLTHROUGH */
+          case '*':  /* 0 or more repetitions */
+            s = pmax_expand(ms, s, pi);
+            break;
+          case '-':  /* 0 or more repetitions (minimum) */
+            s = pmin_expand(ms, s, pi);
+            break;
+          default:  /* no suffix */
+            s++; pi++; goto init;  /* return pmatch(ms, s + 1, pi + 1); */
+        }
+      }
+      break;
+    }
+  }
+  ms->matchdepth++;
+  return s;
+}
+
+
+/* matches at 's' with the compiled pattern 'pt', or else with 'p' */
+#define domatch(ms,s,pt,p) \
+	((pt) != NULL ? pmatch(ms, s, (pt)->items) : match(ms, s, p))
+
+/* }====================================================== */
+
+
 static int str_find_aux (lua_State *L, int find) {
   size_t ls, lp;
   const char *s = luaL_checklstring(L, 1, &ls);
@@ -628,14 +1286,19 @@ static int str_find_aux (lua_State *L, int find) {
     MatchState ms;
     const char *s1 = s + init - 1;
     int anchor = (*p == '^');
+    const Pattern *pt = getpattern(L, 2, anchor);
     if (anchor) {
       p++; lp--;  /* skip anchor character */
     }
     prepstate(&ms, L, s, ls, p, lp);
     do {
       const char *res;
+      if (pt != NULL && !anchor) {  /* skip to where a match may start */
+        s1 = nextstart(pt, s1, ms.src_end);
+        if (s1 == NULL) break;
+      }
       reprepstate(&ms);
-      if ((res=match(&ms, s1, p)) != NULL) {
+      if ((res=domatch(&ms, s1, pt, p)) != NULL) {
         if (find) {
           lua_pushinteger(L, (s1 - s) + 1);  /* start */
           lua_pushinteger(L, res - s);   /* end */
@@ -665,6 +1328,7 @@ static int str_match (lua_State *L) {
 typedef struct GMatchState {
   const char *src;  /* current position */
   const char *p;  /* pattern */
+  const Pattern *pt;  /* compiled pattern (or NULL) */
   const char *lastmatch;  /* end of last match */
   MatchState ms;  /* match state */
 } GMatchState;
@@ -676,8 +1340,13 @@ static int gmatch_aux (lua_State *L) {
   gm->ms.L = L;
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
+    if (gm->pt != NULL) {  /* skip to where a match may start */
+      src = nextstart(gm->pt, src, gm->ms.src_end);
+      if (src == NULL) break;
+    }
     reprepstate(&gm->ms);
-    if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
+    if ((e = domatch(&gm->ms, src, gm->pt, gm->p)) != NULL &&
+        e != gm->lastmatch) {
       gm->src = gm->lastmatch = e;
       return push_captures(&gm->ms, src, e);
     }
@@ -695,7 +1364,13 @@ static int gmatch (lua_State *L) {
   gm = (GMatchState *)lua_newuserdata(L, sizeof(GMatchState));
   prepstate(&gm->ms, L, s, ls, p, lp);
   gm->src = s; gm->p = p; gm->lastmatch = NULL;
-  lua_pushcclosure(L, gmatch_aux, 3);
+  if (*p != '^')  /* ('^' is not an anchor for 'gmatch') */
+    gm->pt = getpattern(L, 2, 0);  /* keep it on closure too */
+  else {
+    gm->pt = NULL;
+    lua_pushnil(L);
+  }
+  lua_pushcclosure(L, gmatch_aux, 4);
   return 1;
 }
 
@@ -768,11 +1443,13 @@ static int str_gsub (lua_State *L) {
   lua_Integer max_s = luaL_optinteger(L, 4, srcl + 1);  /* max replacements */
   int anchor = (*p == '^');
   lua_Integer n = 0;  /* replacement count */
+  const Pattern *pt;
   MatchState ms;
   luaL_Buffer b;
   luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table expected");
+  pt = getpattern(L, 2, anchor);  /* (below the buffer in the stack) */
   luaL_buffinit(L, &b);
   if (anchor) {
     p++; lp--;  /* skip anchor character */
@@ -780,8 +1457,14 @@ static int str_gsub (lua_State *L) {
   prepstate(&ms, L, src, srcl, p, lp);
   while (n < max_s) {
     const char *e;
+    if (pt != NULL && !anchor) {  /* skip to where a match may start */
+      const char *start = nextstart(pt, src, ms.src_end);
+      if (start == NULL) break;  /* no more matches */
+      luaL_addlstring(&b, src, start - src);
+      src = start;
+    }
     reprepstate(&ms);  /* (re)prepare state for new match */
-    if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+    if ((e = domatch(&ms, src, pt, p)) != NULL && e != lastmatch) {  /* match? */
       n++;
       add_value(&ms, &b, src, e, tr);  /* add replacement to buffer */
       src = lastmatch = e;
@@ -978,11 +1661,18 @@ static void addliteral (lua_State *L, luaL_Buffer *b, int arg) {
 }
 
 
-static const char *scanformat (lua_State *L, const char *strfrmt, char *form) {
+/*
+** Skips the flags, width and precision of the conversion at 'strfrmt'
+** and returns where its conversion char is; returns NULL (with an error
+** message in 'msg') if they are invalid.
+*/
+static const char *skipmodifiers (const char *strfrmt, const char **msg) {
   const char *p = strfrmt;
   while (*p != '\0' && strchr(FLAGS, *p) != NULL) p++;  /* skip flags */
-  if ((size_t)(p - strfrmt) >= sizeof(FLAGS)/sizeof(char))
-    luaL_error(L, "invalid format (repeated flags)");
+  if ((size_t)(p - strfrmt) >= sizeof(FLAGS)/sizeof(char)) {
+    *msg = "invalid format (repeated flags)";
+    return NULL;
+  }
   if (isdigit(uchar(*p))) p++;  /* skip width */
   if (isdigit(uchar(*p))) p++;  /* (2 digits at most) */
   if (*p == '.') {
@@ -990,12 +1680,29 @@ static const char *scanformat (lua_State *L, const char *strfrmt, char *form) {
     if (isdigit(uchar(*p))) p++;  /* skip precision */
     if (isdigit(uchar(*p))) p++;  /* (2 digits at most) */
   }
-  if (isdigit(uchar(*p)))
-    luaL_error(L, "invalid format (width or precision too long)");
+  if (isdigit(uchar(*p))) {
+    *msg = "invalid format (width or precision too long)";
+    return NULL;
+  }
+  return p;
+}
+
+
+/* copies the conversion from 'strfrmt' to 'p' (inclusive) into 'form' */
+static void copyform (char *form, const char *strfrmt, const char *p) {
   *(form++) = '%';
   memcpy(form, strfrmt, ((p - strfrmt) + 1) * sizeof(char));
   form += (p - strfrmt) + 1;
   *form = '\0';
+}
+
+
+static const char *scanformat (lua_State *L, const char *strfrmt, char *form) {
+  const char *msg;
+  const char *p = skipmodifiers(strfrmt, &msg);
+  if (p == NULL)
+    luaL_error(L, "%s", msg);
+  copyform(form, strfrmt, p);
   return p;
 }
 
@@ -1013,79 +1720,281 @@ static void addlenmod (char *form, const char *lenmod) {
 }
 
 
+/* valid conversions */
+#define CONVERSIONS	"cdiouxXaAeEfgGqs"
+
+
+/*
+** A piece of a format: a conversion, or the text in the format from
+** 'init' with length 'len' (when 'conv' is 0).
+*/
+typedef struct FormatItem {
+  char conv;  /* conversion char */
+  char simple;  /* whether it has no flags, width or precision */
+  size_t init, len;  /* text */
+  char form[MAX_FORMAT];  /* conversion for 'l_sprintf', with length modifier */
+} FormatItem;
+
+
+/* fills 'item' for conversion 'form' (as given by 'scanformat') */
+static void setconversion (FormatItem *item, const char *form) {
+  size_t l = strlen(form);
+  item->conv = form[l - 1];
+  item->simple = (l == 2);
+  memcpy(item->form, form, l + 1);
+  switch (item->conv) {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+      addlenmod(item->form, LUA_INTEGER_FRMLEN);
+      break;
+    case 'a': case 'A': case 'e': case 'E': case 'f': case 'g': case 'G':
+      addlenmod(item->form, LUA_NUMBER_FRMLEN);
+      break;
+    default: break;
+  }
+}
+
+
+/*
+** Writes integer 'n' for conversion 'conv' with no modifiers into
+** 'buff', without the C library; returns its length.
+*/
+static int formatint (char *buff, lua_Integer n, int conv) {
+  const char *digits = (conv == 'X') ? "0123456789ABCDEF"
+                                     : "0123456789abcdef";
+  char temp[3 * sizeof(lua_Integer) + 1];  /* enough for octal */
+  char *p = temp + sizeof(temp);
+  int neg = (conv == 'd' || conv == 'i') && n < 0;
+  lua_Unsigned u = neg ? 0u - (lua_Unsigned)n : (lua_Unsigned)n;
+  unsigned int base = (conv == 'o') ? 8 : (conv == 'x' || conv == 'X') ? 16
+                                                                      : 10;
+  int nb;
+  do {
+    *--p = digits[u % base];
+    u /= base;
+  } while (u != 0);
+  if (neg)
+    *--p = '-';
+  nb = (int)(temp + sizeof(temp) - p);
+  memcpy(buff, p, nb);
+  return nb;
+}
+
+
+/* adds the conversion 'item' of argument 'arg' to buffer 'b' */
+static void addconversion (lua_State *L, luaL_Buffer *b, int arg,
+                           const FormatItem *item) {
+  char *buff = luaL_prepbuffsize(b, MAX_ITEM);  /* to put formatted item */
+  int nb = 0;  /* number of bytes in added item */
+  switch (item->conv) {
+    case 'c': {
+      int c = (int)luaL_checkinteger(L, arg);
+      if (item->simple) {
+        buff[0] = (char)c;
+        nb = 1;
+      }
+      else
+        nb = l_sprintf(buff, MAX_ITEM, item->form, c);
+      break;
+    }
+    case 'd': case 'i':
+    case 'o': case 'u': case 'x': case 'X': {
+      lua_Integer n = luaL_checkinteger(L, arg);
+      if (item->simple)
+        nb = formatint(buff, n, item->conv);
+      else
+        nb = l_sprintf(buff, MAX_ITEM, item->form, (LUAI_UACINT)n);
+      break;
+    }
+    case 'a': case 'A':
+      nb = lua_number2strx(L, buff, MAX_ITEM, item->form,
+                              luaL_checknumber(L, arg));
+      break;
+    case 'e': case 'E': case 'f':
+    case 'g': case 'G': {
+      lua_Number n = luaL_checknumber(L, arg);
+      nb = l_sprintf(buff, MAX_ITEM, item->form, (LUAI_UACNUMBER)n);
+      break;
+    }
+    case 'q': {
+      addliteral(L, b, arg);
+      break;
+    }
+    case 's': {
+      size_t l;
+      const char *s;
+      if (item->simple && lua_type(L, arg) == LUA_TNUMBER) {
+        if (luaL_getmetafield(L, arg, "__tostring") == LUA_TNIL) {
+          nb = (int)lua_numbertobuff(L, arg, buff);  /* no string needed */
+          break;
+        }
+        lua_pop(L, 1);  /* remove metamethod */
+      }
+      s = luaL_tolstring(L, arg, &l);
+      if (item->simple)  /* no modifiers? */
+        luaL_addvalue(b);  /* keep entire string */
+      else {
+        luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+        if (!strchr(item->form, '.') && l >= 100) {
+          /* no precision and string is too long to be formatted */
+          luaL_addvalue(b);  /* keep entire string */
+        }
+        else {  /* format the string into 'buff' */
+          nb = l_sprintf(buff, MAX_ITEM, item->form, s);
+          lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
+        }
+      }
+      break;
+    }
+  }
+  lua_assert(nb < MAX_ITEM);
+  luaL_addsize(b, nb);
+}
+
+
+/*
+** {------------------------------------------------------
+** Compiled formats
+** -------------------------------------------------------
+*/
+
+/*
+** A format is compiled into a list of items, so that it is scanned
+** only once. Formats with invalid conversions (or too many of them)
+** are not compiled and are scanned on each call, so that they raise
+** their errors as before. Compiled formats are cached (see
+** 'findincache').
+*/
+
+/* maximum number of items in a compiled format */
+#if !defined(MAXFORMATITEMS)
+#define MAXFORMATITEMS	64
+#endif
+
+
+typedef struct Format {
+  int nitems;
+  FormatItem items[1];
+} Format;
+
+
+/* key of the format cache in the registry */
+static const int FORMATCACHE = 0;
+
+
+/*
+** Compiles format 'strfrmt' into 'items'; returns the number of items,
+** or -1 if the format is left to be scanned on each call.
+*/
+static int compileformat (FormatItem *items, const char *strfrmt,
+                                             size_t sfl) {
+  const char *init = strfrmt;
+  const char *strfrmt_end = strfrmt + sfl;
+  int n = 0;
+  while (strfrmt < strfrmt_end) {
+    FormatItem *item = &items[n];
+    if (n == MAXFORMATITEMS)
+      return -1;
+    if (*strfrmt != L_ESC || *(strfrmt + 1) == L_ESC) {  /* text? */
+      const char *e = strfrmt;
+      if (*e == L_ESC) e++;  /* '%%' is text '%' */
+      e++;
+      while (e < strfrmt_end && *e != L_ESC) e++;
+      item->conv = 0;
+      item->init = (size_t)(strfrmt - init);
+      item->len = (size_t)(e - strfrmt);
+      if (*strfrmt == L_ESC) {  /* skip the first '%' of '%%' */
+        item->init++; item->len--;
+      }
+      strfrmt = e;
+    }
+    else {
+      char form[MAX_FORMAT];
+      const char *msg;
+      const char *p = skipmodifiers(++strfrmt, &msg);
+      if (p == NULL || *p == '\0' || strchr(CONVERSIONS, *p) == NULL)
+        return -1;  /* let it raise its error */
+      copyform(form, strfrmt, p);
+      setconversion(item, form);
+      strfrmt = p + 1;
+    }
+    n++;
+  }
+  return n;
+}
+
+
+/*
+** Pushes the compiled form of the format at 'arg' (compiling and
+** caching it if needed), or 'false' if it is not compiled. The caller
+** keeps that value in the stack while it uses the format.
+*/
+static const Format *getformat (lua_State *L, int arg) {
+  size_t sfl;
+  const char *strfrmt = lua_tolstring(L, arg, &sfl);
+  FormatItem items[MAXFORMATITEMS];
+  Format *f;
+  int n;
+  if (findincache(L, &FORMATCACHE, arg))
+    return (const Format *)lua_touserdata(L, -1);  /* NULL for 'false' */
+  n = compileformat(items, strfrmt, sfl);
+  if (n < 0) {
+    f = NULL;
+    lua_pushboolean(L, 0);
+  }
+  else {
+    f = (Format *)lua_newuserdata(L, sizeof(Format) +
+                                     n * sizeof(FormatItem));
+    f->nitems = n;
+    memcpy(f->items, items, n * sizeof(FormatItem));
+  }
+  addtocache(L, arg);
+  return f;
+}
+
+/* }------------------------------------------------------ */
+
+
 static int str_format (lua_State *L) {
   int top = lua_gettop(L);
   int arg = 1;
   size_t sfl;
   const char *strfrmt = luaL_checklstring(L, arg, &sfl);
   const char *strfrmt_end = strfrmt+sfl;
+  const Format *f = getformat(L, arg);  /* (below the buffer) */
   luaL_Buffer b;
   luaL_buffinit(L, &b);
-  while (strfrmt < strfrmt_end) {
-    if (*strfrmt != L_ESC)
-      luaL_addchar(&b, *strfrmt++);
-    else if (*++strfrmt == L_ESC)
-      luaL_addchar(&b, *strfrmt++);  /* %% */
-    else { /* format item */
-      char form[MAX_FORMAT];  /* to store the format ('%...') */
-      char *buff = luaL_prepbuffsize(&b, MAX_ITEM);  /* to put formatted item */
-      int nb = 0;  /* number of bytes in added item */
-      if (++arg > top)
-        luaL_argerror(L, arg, "no value");
-      strfrmt = scanformat(L, strfrmt, form);
-      switch (*strfrmt++) {
-        case 'c': {
-          nb = l_sprintf(buff, MAX_ITEM, form, (int)luaL_checkinteger(L, arg));
-          break;
-        }
-        case 'd': case 'i':
-        case 'o': case 'u': case 'x': case 'X': {
-          lua_Integer n = luaL_checkinteger(L, arg);
-          addlenmod(form, LUA_INTEGER_FRMLEN);
-          nb = l_sprintf(buff, MAX_ITEM, form, (LUAI_UACINT)n);
-          break;
-        }
-        case 'a': case 'A':
-          addlenmod(form, LUA_NUMBER_FRMLEN);
-          nb = lua_number2strx(L, buff, MAX_ITEM, form,
-                                  luaL_checknumber(L, arg));
-          break;
-        case 'e': case 'E': case 'f':
-        case 'g': case 'G': {
-          lua_Number n = luaL_checknumber(L, arg);
-          addlenmod(form, LUA_NUMBER_FRMLEN);
-          nb = l_sprintf(buff, MAX_ITEM, form, (LUAI_UACNUMBER)n);
-          break;
-        }
-        case 'q': {
-          addliteral(L, &b, arg);
-          break;
-        }
-        case 's': {
-          size_t l;
-          const char *s = luaL_tolstring(L, arg, &l);
-          if (form[2] == '\0')  /* no modifiers? */
-            luaL_addvalue(&b);  /* keep entire string */
-          else {
-            luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
-            if (!strchr(form, '.') && l >= 100) {
-              /* no precision and string is too long to be formatted */
-              luaL_addvalue(&b);  /* keep entire string */
-            }
-            else {  /* format the string into 'buff' */
-              nb = l_sprintf(buff, MAX_ITEM, form, s);
-              lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
-            }
-          }
-          break;
-        }
-        default: {  /* also treat cases 'pnLlh' */
+  if (f != NULL) {  /* compiled format? */
+    int i;
+    for (i = 0; i < f->nitems; i++) {
+      const FormatItem *item = &f->items[i];
+      if (item->conv == 0)
+        luaL_addlstring(&b, strfrmt + item->init, item->len);
+      else {
+        if (++arg > top)
+          luaL_argerror(L, arg, "no value");
+        addconversion(L, &b, arg, item);
+      }
+    }
+  }
+  else {
+    while (strfrmt < strfrmt_end) {
+      if (*strfrmt != L_ESC)
+        luaL_addchar(&b, *strfrmt++);
+      else if (*++strfrmt == L_ESC)
+        luaL_addchar(&b, *strfrmt++);  /* %% */
+      else { /* format item */
+        char form[MAX_FORMAT];  /* to store the format ('%...') */
+        FormatItem item;
+        if (++arg > top)
+          luaL_argerror(L, arg, "no value");
+        strfrmt = scanformat(L, strfrmt, form);
+        if (*strfrmt == '\0' || strchr(CONVERSIONS, *strfrmt) == NULL)
           return luaL_error(L, "invalid option '%%%c' to 'format'",
-                               *(strfrmt - 1));
-        }
+                               *strfrmt);  /* also treat cases 'pnLlh' */
+        strfrmt++;
+        setconversion(&item, form);
+        addconversion(L, &b, arg, &item);
       }
-      lua_assert(nb < MAX_ITEM);
-      luaL_addsize(&b, nb);
     }
   }
   luaL_pushresult(&b);
@@ -1292,9 +2201,8 @@ static KOption getdetails (Header *h, size_t totalsize,
 ** the size of a Lua integer, correcting the extra sign-extension
 ** bytes if necessary (by default they would be zeros).
 */
-static void packint (luaL_Buffer *b, lua_Unsigned n,
-                     int islittle, int size, int neg) {
-  char *buff = luaL_prepbuffsize(b, size);
+static void packintto (char *buff, lua_Unsigned n,
+                       int islittle, int size, int neg) {
   int i;
   buff[islittle ? 0 : size - 1] = (char)(n & MC);  /* first byte */
   for (i = 1; i < size; i++) {
@@ -1305,6 +2213,12 @@ static void packint (luaL_Buffer *b, lua_Unsigned n,
     for (i = SZINT; i < size; i++)  /* correct extra bytes */
       buff[islittle ? i : size - 1 - i] = (char)MC;
   }
+}
+
+
+static void packint (luaL_Buffer *b, lua_Unsigned n,
+                     int islittle, int size, int neg) {
+  packintto(luaL_prepbuffsize(b, size), n, islittle, size, neg);
   luaL_addsize(b, size);  /* add result to buffer */
 }
 
@@ -1536,6 +2450,219 @@ static int str_unpack (lua_State *L) {
   return n + 1;
 }
 
+
+/*
+** {------------------------------------------------------
+** Arrays
+** -------------------------------------------------------
+*/
+
+/*
+** 'packarray' and 'unpackarray' convert between lists of numbers and
+** strings of equal-sized binary items, described by a format with a
+** single integer or float option (plus endianness and spaces). Items
+** are contiguous: alignment does not apply. Items in native order with
+** the size of a C type are copied as that type; others go byte by byte.
+*/
+
+
+/* reads the format of an array; returns its option and size */
+static KOption getarrayoption (lua_State *L, Header *h, int *psize) {
+  const char *fmt = luaL_checkstring(L, 1);
+  KOption res = Knop;
+  initheader(L, h);
+  while (*fmt != '\0') {
+    int size;
+    KOption opt = getoption(h, &fmt, &size);
+    if (opt == Knop)
+      continue;
+    if (res != Knop || (opt != Kint && opt != Kuint && opt != Kfloat))
+      luaL_argerror(L, 1, "format must have a single numeric option");
+    res = opt;
+    *psize = size;
+  }
+  if (res == Knop)
+    luaL_argerror(L, 1, "format must have a single numeric option");
+  return res;
+}
+
+
+/* true if items of 'size' bytes in order 'islittle' are a native type */
+#define isnativeint(h,size) \
+	((h)->islittle == nativeendian.little && \
+	 ((size) == 1 || (size) == sizeof(short) || (size) == sizeof(int) || \
+	  (size) == SZINT))
+
+
+/* stores 'n' as a native integer with 'size' bytes */
+static void storeint (char *buff, lua_Unsigned n, int size) {
+  if (size == 1)
+    *buff = (char)n;
+  else if (size == sizeof(short)) {
+    unsigned short v = (unsigned short)n;
+    memcpy(buff, &v, sizeof(v));
+  }
+  else if (size == sizeof(int)) {
+    unsigned int v = (unsigned int)n;
+    memcpy(buff, &v, sizeof(v));
+  }
+  else
+    memcpy(buff, &n, sizeof(n));
+}
+
+
+/* loads a native integer with 'size' bytes */
+static lua_Integer loadint (const char *buff, int size, int issigned) {
+  if (size == 1)
+    return issigned ? (lua_Integer)(signed char)*buff
+                    : (lua_Integer)uchar(*buff);
+  else if (size == sizeof(short)) {
+    unsigned short v;
+    memcpy(&v, buff, sizeof(v));
+    return issigned ? (lua_Integer)(short)v : (lua_Integer)v;
+  }
+  else if (size == sizeof(int)) {
+    unsigned int v;
+    memcpy(&v, buff, sizeof(v));
+    return issigned ? (lua_Integer)(int)v : (lua_Integer)v;
+  }
+  else {
+    lua_Unsigned v;
+    memcpy(&v, buff, sizeof(v));
+    return (lua_Integer)v;
+  }
+}
+
+
+static void packfloat (char *buff, lua_Number n, int size, int islittle) {
+  Ftypes u;
+  if (size == sizeof(u.f)) u.f = (float)n;
+  else if (size == sizeof(u.d)) u.d = (double)n;
+  else u.n = n;
+  if (islittle == nativeendian.little)
+    memcpy(buff, u.buff, size);
+  else
+    copywithendian(buff, u.buff, size, islittle);
+}
+
+
+static lua_Number unpackfloat (const char *buff, int size, int islittle) {
+  Ftypes u;
+  if (islittle == nativeendian.little)
+    memcpy(u.buff, buff, size);
+  else
+    copywithendian(u.buff, buff, size, islittle);
+  if (size == sizeof(u.f)) return (lua_Number)u.f;
+  else if (size == sizeof(u.d)) return (lua_Number)u.d;
+  else return u.n;
+}
+
+
+static void arrayerror (lua_State *L, const char *msg, lua_Integer i) {
+  luaL_error(L, "%s (at index %I) in table for 'packarray'",
+                msg, (LUAI_UACINT)i);
+}
+
+
+static int str_packarray (lua_State *L) {
+  Header h;
+  int size;
+  KOption opt = getarrayoption(L, &h, &size);
+  int native = isnativeint(&h, size);
+  lua_Integer i, e;
+  luaL_Buffer b;
+  lua_Unsigned n, k;
+  char *buff;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  i = luaL_optinteger(L, 3, 1);
+  e = luaL_opt(L, luaL_checkinteger, 4, luaL_len(L, 2));
+  if (i > e) {  /* empty range? */
+    lua_pushliteral(L, "");
+    return 1;
+  }
+  n = (lua_Unsigned)e - i;  /* number of items minus 1 (avoid overflows) */
+  if (n >= MAXSIZE / size)
+    return luaL_error(L, "resulting string too large");
+  n++;
+  buff = luaL_buffinitsize(L, &b, (size_t)n * size);
+  for (k = 0; k < n; k++, buff += size) {
+    lua_Integer idx = i + (lua_Integer)k;
+    lua_geti(L, 2, idx);
+    if (opt == Kfloat) {
+      int isnum;
+      lua_Number x = lua_tonumberx(L, -1, &isnum);
+      if (!isnum) arrayerror(L, "invalid value", idx);
+      packfloat(buff, x, size, h.islittle);
+    }
+    else {
+      int isnum;
+      lua_Integer x = lua_tointegerx(L, -1, &isnum);
+      if (!isnum) arrayerror(L, "invalid value", idx);
+      if (size < SZINT) {  /* need overflow check? */
+        if (opt == Kint) {
+          lua_Integer lim = (lua_Integer)1 << ((size * NB) - 1);
+          if (!(-lim <= x && x < lim))
+            arrayerror(L, "integer overflow", idx);
+        }
+        else if ((lua_Unsigned)x >= ((lua_Unsigned)1 << (size * NB)))
+          arrayerror(L, "unsigned overflow", idx);
+      }
+      if (native)
+        storeint(buff, (lua_Unsigned)x, size);
+      else
+        packintto(buff, (lua_Unsigned)x, h.islittle, size,
+                  (opt == Kint && x < 0));
+    }
+    lua_pop(L, 1);
+  }
+  luaL_pushresultsize(&b, (size_t)n * size);
+  return 1;
+}
+
+
+static int str_unpackarray (lua_State *L) {
+  Header h;
+  int size;
+  KOption opt = getarrayoption(L, &h, &size);
+  size_t ld;
+  const char *data = luaL_checklstring(L, 2, &ld);
+  size_t pos = (size_t)posrelat(luaL_optinteger(L, 3, 1), ld) - 1;
+  lua_Integer n;
+  lua_Integer k;
+  int native = isnativeint(&h, size);
+  luaL_argcheck(L, pos <= ld, 3, "initial position out of string");
+  if (lua_isnoneornil(L, 4))  /* all items up to the end */
+    n = (lua_Integer)((ld - pos) / size);
+  else {
+    n = luaL_checkinteger(L, 4);
+    luaL_argcheck(L, n >= 0, 4, "out of range");
+    if ((lua_Unsigned)n > (ld - pos) / size)
+      luaL_argerror(L, 2, "data string too short");
+  }
+  if (lua_isnoneornil(L, 5)) {
+    lua_settop(L, 4);
+    lua_createtable(L, (n < INT_MAX) ? (int)n : INT_MAX, 0);
+  }
+  else {
+    luaL_checktype(L, 5, LUA_TTABLE);
+    lua_settop(L, 5);
+  }
+  data += pos;
+  for (k = 1; k <= n; k++, data += size) {
+    if (opt == Kfloat)
+      lua_pushnumber(L, unpackfloat(data, size, h.islittle));
+    else if (native)
+      lua_pushinteger(L, loadint(data, size, (opt == Kint)));
+    else
+      lua_pushinteger(L, unpackint(L, data, h.islittle, size, (opt == Kint)));
+    lua_seti(L, 5, k);
+  }
+  lua_pushinteger(L, (lua_Integer)(pos + (size_t)n * size) + 1);
+  return 2;  /* table and next position */
+}
+
+/* }------------------------------------------------------ */
+
 /* }====================================================== */
 
 
@@ -1557,6 +2684,8 @@ static const luaL_Reg strlib[] = {
   {"pack", str_pack},
   {"packsize", str_packsize},
   {"unpack", str_unpack},
+  {"packarray", str_packarray},
+  {"unpackarray", str_unpackarray},
   {NULL, NULL}
 };
 
@@ -1577,6 +2706,9 @@ static void createmetatable (lua_State *L) {
 ** Open string library
 */
 LUAMOD_API int luaopen_string (lua_State *L) {
+#if defined(LUA_USE_SIMD)
+  hasavx2 = __builtin_cpu_supports("avx2");
+#endif
   luaL_newlib(L, strlib);
   createmetatable(L);
   return 1;
@@ -21,10 +21,15 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** Tables whose only non-array keys are a few short strings keep them in
+** a shape (shared by all tables with the same keys) and their values in
+** a dense 'slots' vector; they switch to a regular hash part as soon as
+** they get any other key.
 */
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -55,21 +60,29 @@
 #define MAXHBITS	(MAXABITS - 1)
 
 
-#define hashpow2(t,n)		(gnode(t, lmod((n), sizenode(t))))
+/*
+** Hash part of a table is usually 'node' with 2^'lsizenode' entries;
+** while it grows incrementally, keys not yet migrated are still in
+** 'oldnode', with 2^'oldlsizenode' entries. The macros below take a
+** node vector and the log2 of its size.
+*/
+#define hashpow2(nd,ls,n)	(&(nd)[lmod((n), twoto(ls))])
 
-#define hashstr(t,str)		hashpow2(t, (str)->hash)
-#define hashboolean(t,p)	hashpow2(t, p)
-#define hashint(t,i)		hashpow2(t, i)
+#define hashstr(t,str)		hashpow2((t)->node, (t)->lsizenode, (str)->hash)
+#define hashint(t,i)		hashpow2((t)->node, (t)->lsizenode, i)
 
 
 /*
 ** for some types, it is better to avoid modulus by power of 2, as
 ** they tend to have many 2 factors.
 */
-#define hashmod(t,n)	(gnode(t, ((n) % ((sizenode(t)-1)|1))))
+#define hashmod(nd,ls,n)	(&(nd)[(n) % ((twoto(ls)-1)|1)])
+
+
+#define hashpointer(nd,ls,p)	hashmod(nd, ls, point2uint(p))
 
 
-#define hashpointer(t,p)	hashmod(t, point2uint(p))
+#define mainposition(t,key)	mainpositionin((t)->node, (t)->lsizenode, key)
 
 
 #define dummynode		(&dummynode_)
@@ -111,31 +124,148 @@ static int l_hashfloat (lua_Number n) {
 
 
 /*
-** returns the 'main' position of an element in a table (that is, the index
-** of its hash value)
+** returns the 'main' position of an element in node vector 'nd' with
+** size 2^'ls' (that is, the index of its hash value)
 */
-static Node *mainposition (const Table *t, const TValue *key) {
+static Node *mainpositionin (Node *nd, int ls, const TValue *key) {
   switch (ttype(key)) {
     case LUA_TNUMINT:
-      return hashint(t, ivalue(key));
+      return hashpow2(nd, ls, ivalue(key));
     case LUA_TNUMFLT:
-      return hashmod(t, l_hashfloat(fltvalue(key)));
+      return hashmod(nd, ls, l_hashfloat(fltvalue(key)));
     case LUA_TSHRSTR:
-      return hashstr(t, tsvalue(key));
+      return hashpow2(nd, ls, tsvalue(key)->hash);
     case LUA_TLNGSTR:
-      return hashpow2(t, luaS_hashlongstr(tsvalue(key)));
+      return hashpow2(nd, ls, luaS_hashlongstr(tsvalue(key)));
     case LUA_TBOOLEAN:
-      return hashboolean(t, bvalue(key));
+      return hashpow2(nd, ls, bvalue(key));
     case LUA_TLIGHTUSERDATA:
-      return hashpointer(t, pvalue(key));
+      return hashpointer(nd, ls, pvalue(key));
     case LUA_TLCF:
-      return hashpointer(t, fvalue(key));
+      return hashpointer(nd, ls, fvalue(key));
     default:
       lua_assert(!ttisdeadkey(key));
-      return hashpointer(t, gcvalue(key));
+      return hashpointer(nd, ls, gcvalue(key));
+  }
+}
+
+
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+#define sizeshape(n)	(offsetof(Shape, keys) + sizeof(TString *) * (n))
+
+
+/* true if a new short-string key for 't' can go to a slot */
+#define canaddslot(t)	((t)->shape != NULL \
+	? (t)->shape->nkeys < LUAI_MAXSHAPE \
+	: (LUAI_MAXSHAPE > 0 && isdummy(t)))
+
+
+/*
+** drops a reference to shape 's'; a shape with no more references is
+** removed from the tree, which releases its reference to its parent
+*/
+static void releaseshape (lua_State *L, Shape *s) {
+  while (--s->nref == 0 && s->parent != NULL) {  /* unused (and not root)? */
+    Shape *p = s->parent;
+    Shape **c = &p->child;
+    while (*c != s)  /* find it in its parent's list */
+      c = &(*c)->sibling;
+    *c = s->sibling;  /* unlink it */
+    luaM_freemem(L, s, sizeshape(s->nkeys));
+    s = p;
+  }
+}
+
+
+/*
+** returns the shape extending 's' with 'key', creating it if needed.
+** Found shapes move to the front of the list, as the same transitions
+** tend to be taken over and over.
+*/
+static Shape *getchild (lua_State *L, Shape *s, TString *key) {
+  Shape **c;
+  Shape *ns;
+  int i;
+  for (c = &s->child; *c != NULL; c = &(*c)->sibling) {
+    ns = *c;
+    if (ns->keys[s->nkeys] == key) {  /* found? */
+      *c = ns->sibling;  /* move it to the front */
+      ns->sibling = s->child;
+      s->child = ns;
+      return ns;
+    }
+  }
+  ns = cast(Shape *, luaM_malloc(L, sizeshape(s->nkeys + 1)));
+  ns->parent = s;
+  ns->child = NULL;
+  ns->sibling = s->child;
+  s->child = ns;
+  ns->nref = 0;
+  ns->nkeys = s->nkeys + 1;
+  for (i = 0; i < s->nkeys; i++)
+    ns->keys[i] = s->keys[i];
+  ns->keys[s->nkeys] = key;
+  s->nref++;  /* new shape refers to its parent */
+  return ns;
+}
+
+
+static void setshape (lua_State *L, Table *t, Shape *s) {
+  Shape *old = t->shape;
+  s->nref++;
+  t->shape = s;
+  if (old != NULL)
+    releaseshape(L, old);
+}
+
+
+static void setslotvector (lua_State *L, Table *t, unsigned int size) {
+  unsigned int i;
+  lua_assert(size <= LUAI_MAXSHAPE);
+  luaM_reallocvector(L, t->u.slots, t->sizeslots, size, TValue);
+  for (i = t->sizeslots; i < size; i++)
+     setnilvalue(&t->u.slots[i]);
+  t->sizeslots = cast_byte(size);
+}
+
+
+/*
+** adds short string 'key' to a table using a shape (or with an empty
+** hash part) and returns its slot
+*/
+static TValue *addslot (lua_State *L, Table *t, TString *key) {
+  unsigned int n;
+  if (t->shape == NULL)  /* first field? */
+    setshape(L, t, &G(L)->rootshape);
+  n = t->shape->nkeys;
+  lua_assert(n < LUAI_MAXSHAPE);
+  if (n == t->sizeslots) {  /* slots are full? */
+    unsigned int size = (n == 0) ? 1 : 2 * n;
+    setslotvector(L, t, (size <= LUAI_MAXSHAPE) ? size : LUAI_MAXSHAPE);
+  }
+  setshape(L, t, getchild(L, t->shape, key));
+  lua_assert(ttisnil(&t->u.slots[n]));
+  return &t->u.slots[n];
+}
+
+
+static const TValue *getslot (const Table *t, TString *key) {
+  const Shape *s = t->shape;
+  int i;
+  for (i = 0; i < s->nkeys; i++) {
+    if (s->keys[i] == key)
+      return &t->u.slots[i];
   }
+  return luaO_nilobject;
 }
 
+/* }============================================================= */
+
 
 /*
 ** returns the index for 'key' if 'key' is an appropriate key to live in
@@ -162,6 +292,15 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   i = arrayindex(key);
   if (i != 0 && i <= t->sizearray)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
+  else if (t->shape != NULL) {  /* fields are in the slots */
+    const Shape *s = t->shape;
+    for (i = 0; i < s->nkeys; i++) {
+      if (ttisshrstring(key) && s->keys[i] == tsvalue(key))
+        return (i + 1) + t->sizearray;  /* slots are numbered after array */
+    }
+    luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+    return 0;  /* to avoid warnings */
+  }
   else {
     int nx;
     Node *n = mainposition(t, key);
@@ -183,8 +322,93 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
 }
 
 
+/*
+** {=============================================================
+** Incremental rehash
+** ==============================================================
+*/
+
+static void setnodevector (lua_State *L, Table *t, unsigned int size);
+static Node *insertkey (lua_State *L, Table *t, const TValue *key);
+
+
+/*
+** Large hash parts are resized without re-inserting all their keys at
+** once: the current part becomes the old part, and each new key first
+** moves some old entries to the new part, which has room for 'nhsize'
+** keys. As it gets at most one new key per 'LUAI_REHASHSTEP' migrated
+** entries, it also gets room for those, so that it cannot fill up
+** before the migration ends.
+*/
+static void startrehash (lua_State *L, Table *t, unsigned int nhsize) {
+  Node *old = t->node;
+  lu_byte lsize = t->lsizenode;
+  nhsize += sizenode(t) / LUAI_REHASHSTEP + 1;
+  setnodevector(L, t, nhsize);  /* table unchanged on errors */
+  t->u.oldnode = old;
+  t->oldlsizenode = lsize;
+  t->oldpos = 0;
+}
+
+
+/*
+** migrates up to 'n' nodes from the old hash part to the new one, and
+** frees the old part once it is empty
+*/
+static void rehashstep (lua_State *L, Table *t, unsigned int n) {
+  Node *old = t->u.oldnode;
+  unsigned int size = twoto(t->oldlsizenode);
+  for (; n > 0 && t->oldpos < size; n--) {
+    Node *o = &old[t->oldpos++];
+    if (!ttisnil(gval(o))) {
+      Node *mp = insertkey(L, t, gkey(o));
+      lua_assert(mp != NULL);  /* new part has room for all of them */
+      /* doesn't need barrier, as entry was already present in the table */
+      setobjt2t(L, gval(mp), gval(o));
+      setnilvalue(gval(o));
+    }
+  }
+  if (t->oldpos == size) {  /* migration is complete? */
+    t->u.oldnode = NULL;
+    t->oldlsizenode = 0;
+    t->oldpos = 0;
+    luaM_freearray(L, old, size);
+  }
+}
+
+
+#define finishrehash(L,t)	rehashstep(L, t, twoto((t)->oldlsizenode))
+
+
+/*
+** search function for keys still in the old hash part. Nodes before
+** 'oldpos' were already migrated (or were empty), so they do not count.
+*/
+static const TValue *getold (Table *t, const TValue *key) {
+  Node *n = mainpositionin(t->u.oldnode, t->oldlsizenode, key);
+  for (;;) {  /* check whether 'key' is somewhere in the chain */
+    if (luaV_rawequalobj(gkey(n), key)) {
+      if (cast(unsigned int, n - t->u.oldnode) < t->oldpos)
+        return luaO_nilobject;  /* already migrated */
+      return gval(n);  /* that's it */
+    }
+    else {
+      int nx = gnext(n);
+      if (nx == 0)
+        return luaO_nilobject;  /* not found */
+      n += nx;
+    }
+  }
+}
+
+/* }============================================================= */
+
+
 int luaH_next (lua_State *L, Table *t, StkId key) {
-  unsigned int i = findindex(L, t, key);  /* find original element */
+  unsigned int i;
+  if (isrehashing(t))  /* traversal needs a single hash part */
+    finishrehash(L, t);
+  i = findindex(L, t, key);  /* find original element */
   for (; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
       setivalue(key, i + 1);
@@ -192,6 +416,16 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
       return 1;
     }
   }
+  if (t->shape != NULL) {  /* slots instead of hash part? */
+    for (i -= t->sizearray; i < t->shape->nkeys; i++) {
+      if (!ttisnil(&t->u.slots[i])) {  /* a non-nil value? */
+        setsvalue2s(L, key, t->shape->keys[i]);
+        setobj2s(L, key+1, &t->u.slots[i]);
+        return 1;
+      }
+    }
+    return 0;  /* no more elements */
+  }
   for (i -= t->sizearray; cast_int(i) < sizenode(t); i++) {  /* hash part */
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       setobj2s(L, key, gkey(gnode(t, i)));
@@ -298,6 +532,19 @@ static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
 }
 
 
+static unsigned int numuseslots (const Table *t) {
+  unsigned int ause = 0;
+  int i;
+  if (t->shape != NULL) {
+    for (i = 0; i < t->shape->nkeys; i++) {
+      if (!ttisnil(&t->u.slots[i]))
+        ause++;
+    }
+  }
+  return ause;
+}
+
+
 static void setarrayvector (lua_State *L, Table *t, unsigned int size) {
   unsigned int i;
   luaM_reallocvector(L, t->array, t->sizearray, size, TValue);
@@ -344,14 +591,19 @@ static void auxsetnode (lua_State *L, void *ud) {
 }
 
 
-void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
+static void resize (lua_State *L, Table *t, unsigned int nasize,
                                           unsigned int nhsize) {
   unsigned int i;
   int j;
   AuxsetnodeT asn;
-  unsigned int oldasize = t->sizearray;
-  int oldhsize = allocsizenode(t);
-  Node *nold = t->node;  /* save old hash ... */
+  unsigned int oldasize;
+  int oldhsize;
+  Node *nold;
+  if (isrehashing(t))
+    finishrehash(L, t);
+  oldasize = t->sizearray;
+  oldhsize = allocsizenode(t);
+  nold = t->node;  /* save old hash ... */
   if (nasize > oldasize)  /* array part must grow? */
     setarrayvector(L, t, nasize);
   /* create new hash part with appropriate size */
@@ -384,6 +636,55 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
 }
 
 
+/*
+** moves the fields of a table using a shape to a new hash part with
+** (at least) 'nhsize' entries
+*/
+static void shapetohash (lua_State *L, Table *t, unsigned int nasize,
+                                                 unsigned int nhsize) {
+  Shape *s = t->shape;
+  TValue *slots = t->u.slots;
+  unsigned int size = t->sizeslots;
+  int i;
+  resize(L, t, nasize, nhsize);  /* may raise an error; table still valid */
+  t->shape = NULL;  /* from now on, fields go to the hash part */
+  t->u.slots = NULL;
+  t->sizeslots = 0;
+  for (i = 0; i < s->nkeys; i++) {
+    if (!ttisnil(&slots[i])) {
+      TValue k;
+      setsvalue(L, &k, s->keys[i]);
+      /* hash part has room for all of them, so this cannot fail */
+      setobjt2t(L, luaH_set(L, t, &k), &slots[i]);
+    }
+  }
+  releaseshape(L, s);
+  luaM_freearray(L, slots, size);
+}
+
+
+/*
+** Resize table 't'. A fresh table asking for a few hash entries (e.g.,
+** from a constructor with named fields) gets them as slots, and tables
+** using a shape keep it, only growing their array part.
+*/
+void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
+                                          unsigned int nhsize) {
+  if (t->shape == NULL && !(isdummy(t) && nhsize <= LUAI_MAXSHAPE))
+    resize(L, t, nasize, nhsize);
+  else {
+    lua_assert(t->shape == NULL || nasize >= t->sizearray);
+    resize(L, t, nasize, 0);
+    if (nhsize > 0) {
+      if (t->shape == NULL)
+        setshape(L, t, &G(L)->rootshape);
+      if (nhsize > t->sizeslots && nhsize <= LUAI_MAXSHAPE)
+        setslotvector(L, t, nhsize);
+    }
+  }
+}
+
+
 void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize) {
   int nsize = allocsizenode(t);
   luaH_resize(L, t, nasize, nsize);
@@ -396,19 +697,30 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
   unsigned int asize;  /* optimal size for array part */
   unsigned int na;  /* number of keys in the array part */
   unsigned int nums[MAXABITS + 1];
+  unsigned int nslots;  /* number of fields in slots */
   int i;
   int totaluse;
   for (i = 0; i <= MAXABITS; i++) nums[i] = 0;  /* reset counts */
   na = numusearray(t, nums);  /* count keys in array part */
   totaluse = na;  /* all those keys are integer keys */
   totaluse += numusehash(t, nums, &na);  /* count keys in hash part */
+  nslots = numuseslots(t);  /* count keys in slots (never integers) */
+  totaluse += nslots;
   /* count extra key */
   na += countint(ek, nums);
   totaluse++;
   /* compute new size for array part */
   asize = computesizes(nums, &na);
   /* resize the table to new computed sizes */
-  luaH_resize(L, t, asize, totaluse - na);
+  if (t->shape == NULL && t->lsizenode >= LUAI_INCREHASHBITS &&
+      asize == t->sizearray)  /* large hash part and same array part? */
+    startrehash(L, t, totaluse - na);  /* move its live keys a few at a time */
+  else if (t->shape == NULL)
+    resize(L, t, asize, totaluse - na);
+  else if (totaluse - na == nslots)  /* all other keys go to array part? */
+    resize(L, t, asize, 0);  /* keep the shape */
+  else
+    shapetohash(L, t, asize, totaluse - na);
 }
 
 
@@ -425,6 +737,11 @@ Table *luaH_new (lua_State *L) {
   t->flags = cast_byte(~0);
   t->array = NULL;
   t->sizearray = 0;
+  t->shape = NULL;
+  t->u.slots = NULL;
+  t->sizeslots = 0;
+  t->oldlsizenode = 0;
+  t->oldpos = 0;
   setnodevector(L, t, 0);
   return t;
 }
@@ -433,11 +750,54 @@ Table *luaH_new (lua_State *L) {
 void luaH_free (lua_State *L, Table *t) {
   if (!isdummy(t))
     luaM_freearray(L, t->node, cast(size_t, sizenode(t)));
+  if (t->shape != NULL) {
+    releaseshape(L, t->shape);
+    luaM_freearray(L, t->u.slots, t->sizeslots);
+  }
+  else if (isrehashing(t))
+    luaM_freearray(L, t->u.oldnode, cast(size_t, twoto(t->oldlsizenode)));
   luaM_freearray(L, t->array, t->sizearray);
   luaM_free(L, t);
 }
 
 
+/*
+** Removes all entries of 't' but keeps its array part, hash part and
+** slots, so that it can be filled again without resizing. A table using
+** a shape goes back to the empty shape.
+*/
+void luaH_clear (lua_State *L, Table *t) {
+  unsigned int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (t->shape != NULL) {
+    for (i = 0; i < t->sizeslots; i++)
+      setnilvalue(&t->u.slots[i]);
+    setshape(L, t, &G(L)->rootshape);
+  }
+  else {
+    if (isrehashing(t)) {  /* old part would only be migrated to be erased */
+      luaM_freearray(L, t->u.oldnode, cast(size_t, twoto(t->oldlsizenode)));
+      t->u.oldnode = NULL;
+      t->oldlsizenode = 0;
+      t->oldpos = 0;
+    }
+    if (!isdummy(t)) {
+      int size = sizenode(t);
+      int j;
+      for (j = 0; j < size; j++) {
+        Node *n = gnode(t, j);
+        gnext(n) = 0;
+        setnilvalue(wgkey(n));
+        setnilvalue(gval(n));
+      }
+      t->lastfree = gnode(t, size);  /* all positions are free */
+    }
+  }
+  invalidateTMcache(t);
+}
+
+
 static Node *getfreepos (Table *t) {
   if (!isdummy(t)) {
     while (t->lastfree > t->node) {
@@ -456,30 +816,16 @@ static Node *getfreepos (Table *t) {
 ** position is free. If not, check whether colliding node is in its main
 ** position or not: if it is not, move colliding node to an empty place and
 ** put new key in its main position; otherwise (colliding node is in its main
-** position), new key goes to an empty position.
+** position), new key goes to an empty position. Returns NULL if there is
+** no free position.
 */
-TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
-  Node *mp;
-  TValue aux;
-  if (ttisnil(key)) luaG_runerror(L, "table index is nil");
-  else if (ttisfloat(key)) {
-    lua_Integer k;
-    if (luaV_tointeger(key, &k, 0)) {  /* does index fit in an integer? */
-      setivalue(&aux, k);
-      key = &aux;  /* insert it as an integer */
-    }
-    else if (luai_numisnan(fltvalue(key)))
-      luaG_runerror(L, "table index is NaN");
-  }
-  mp = mainposition(t, key);
+static Node *insertkey (lua_State *L, Table *t, const TValue *key) {
+  Node *mp = mainposition(t, key);
   if (!ttisnil(gval(mp)) || isdummy(t)) {  /* main position is taken? */
     Node *othern;
     Node *f = getfreepos(t);  /* get a free place */
-    if (f == NULL) {  /* cannot find a free place? */
-      rehash(L, t, key);  /* grow table */
-      /* whatever called 'newkey' takes care of TM cache */
-      return luaH_set(L, t, key);  /* insert key into grown table */
-    }
+    if (f == NULL)  /* cannot find a free place? */
+      return NULL;
     lua_assert(!isdummy(t));
     othern = mainposition(t, gkey(mp));
     if (othern != mp) {  /* is colliding node out of its main position? */
@@ -504,8 +850,38 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
     }
   }
   setnodekey(L, &mp->i_key, key);
-  luaC_barrierback(L, t, key);
   lua_assert(ttisnil(gval(mp)));
+  return mp;
+}
+
+
+TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
+  Node *mp;
+  TValue aux;
+  if (ttisnil(key)) luaG_runerror(L, "table index is nil");
+  else if (ttisfloat(key)) {
+    lua_Integer k;
+    if (luaV_tointeger(key, &k, 0)) {  /* does index fit in an integer? */
+      setivalue(&aux, k);
+      key = &aux;  /* insert it as an integer */
+    }
+    else if (luai_numisnan(fltvalue(key)))
+      luaG_runerror(L, "table index is NaN");
+  }
+  else if (ttisshrstring(key) && canaddslot(t)) {
+    TValue *slot = addslot(L, t, tsvalue(key));
+    luaC_barrierback(L, t, key);
+    return slot;
+  }
+  if (isrehashing(t))
+    rehashstep(L, t, LUAI_REHASHSTEP);  /* pay for this key */
+  mp = insertkey(L, t, key);
+  if (mp == NULL) {  /* cannot find a free place? */
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' takes care of TM cache */
+    return luaH_set(L, t, key);  /* insert key into grown table */
+  }
+  luaC_barrierback(L, t, key);
   return gval(mp);
 }
 
@@ -528,6 +904,11 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
         n += nx;
       }
     }
+    if (isrehashing(t)) {  /* key may not have been migrated yet */
+      TValue k;
+      setivalue(&k, key);
+      return getold(t, &k);
+    }
     return luaO_nilobject;
   }
 }
@@ -537,22 +918,64 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 ** search function for short strings
 */
 const TValue *luaH_getshortstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
+  Node *n;
   lua_assert(key->tt == LUA_TSHRSTR);
+  if (t->shape != NULL)
+    return getslot(t, key);
+  n = hashstr(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     const TValue *k = gkey(n);
     if (ttisshrstring(k) && eqshrstr(tsvalue(k), key))
       return gval(n);  /* that's it */
     else {
       int nx = gnext(n);
-      if (nx == 0)
+      if (nx == 0) {
+        if (isrehashing(t)) {  /* key may not have been migrated yet */
+          TValue ko;
+          setsvalue(cast(lua_State *, NULL), &ko, key);
+          return getold(t, &ko);
+        }
         return luaO_nilobject;  /* not found */
+      }
       n += nx;
     }
   }
 }
 
 
+/*
+** 'luaH_getshortstr' with a hint of where 'key' was found last time:
+** a slot of the shape or a node of the hash part. The hint is checked
+** before use and updated when the key is found elsewhere, so it never
+** needs to be invalidated.
+*/
+const TValue *luaH_getshortstrhint (Table *t, TString *key,
+                                    unsigned int *hint) {
+  unsigned int h = *hint;
+  const TValue *res;
+  if (t->shape != NULL) {
+    if (h < t->shape->nkeys && t->shape->keys[h] == key)
+      return &t->u.slots[h];
+    res = getslot(t, key);
+    if (res != luaO_nilobject)
+      *hint = cast(unsigned int, res - t->u.slots);
+  }
+  else {
+    Node *n;
+    if (h < cast(unsigned int, sizenode(t))) {
+      n = gnode(t, h);
+      if (ttisshrstring(gkey(n)) && eqshrstr(tsvalue(gkey(n)), key))
+        return gval(n);
+    }
+    res = luaH_getshortstr(t, key);
+    n = cast(Node *, cast(char *, res) - offsetof(Node, i_val));
+    if (gnode(t, 0) <= n && n < gnode(t, sizenode(t)))  /* in hash part? */
+      *hint = cast(unsigned int, n - gnode(t, 0));
+  }
+  return res;
+}
+
+
 /*
 ** "Generic" get version. (Not that generic: not valid for integers,
 ** which may be in array part, nor for floats with integral values.)
@@ -564,8 +987,8 @@ static const TValue *getgeneric (Table *t, const TValue *key) {
       return gval(n);  /* that's it */
     else {
       int nx = gnext(n);
-      if (nx == 0)
-        return luaO_nilobject;  /* not found */
+      if (nx == 0)  /* not found (maybe not migrated yet) */
+        return isrehashing(t) ? getold(t, key) : luaO_nilobject;
       n += nx;
     }
   }
@@ -677,6 +1100,150 @@ lua_Unsigned luaH_getn (Table *t) {
 
 
 
+/*
+** {======================================================
+** Sorting of array parts (see 'lua_sortarray')
+** =======================================================
+*/
+
+/* sizes of the runs sorted by insertion before merging */
+#define SORTRUN		16
+
+
+/*
+** Radix sort of integers, one byte per pass: keys are the values with
+** their sign bits flipped (so that they sort as unsigned), and passes
+** where all keys have the same byte are skipped. Values are rebuilt
+** from the keys.
+*/
+static void sortints (lua_State *L, TValue *a, unsigned int n) {
+  unsigned int count[sizeof(lua_Unsigned)][256];
+  const lua_Unsigned flip = ~(~(lua_Unsigned)0 >> 1);
+  lua_Unsigned *keys = luaM_newvector(L, 2 * (size_t)n, lua_Unsigned);
+  lua_Unsigned *from = keys;
+  lua_Unsigned *to = keys + n;
+  unsigned int i;
+  size_t b;
+  memset(count, 0, sizeof(count));
+  for (i = 0; i < n; i++) {
+    lua_Unsigned k = l_castS2U(ivalue(&a[i])) ^ flip;
+    keys[i] = k;
+    for (b = 0; b < sizeof(lua_Unsigned); b++)
+      count[b][(k >> (8 * b)) & 0xff]++;
+  }
+  for (b = 0; b < sizeof(lua_Unsigned); b++) {
+    unsigned int *c = count[b];
+    unsigned int sum = 0;
+    int d;
+    if (c[(keys[0] >> (8 * b)) & 0xff] == n)
+      continue;  /* all keys have the same byte here */
+    for (d = 0; d < 256; d++) {  /* counts -> positions */
+      unsigned int cd = c[d];
+      c[d] = sum;
+      sum += cd;
+    }
+    for (i = 0; i < n; i++)
+      to[c[(from[i] >> (8 * b)) & 0xff]++] = from[i];
+    { lua_Unsigned *temp = from; from = to; to = temp; }
+  }
+  for (i = 0; i < n; i++)
+    setivalue(&a[i], l_castU2S(from[i] ^ flip));
+  luaM_freearray(L, keys, 2 * (size_t)n);
+}
+
+
+static int sortlt (lua_State *L, const TValue *l, const TValue *r) {
+  if (ttisinteger(l) && ttisinteger(r))
+    return ivalue(l) < ivalue(r);
+  else if (ttisfloat(l) && ttisfloat(r))
+    return luai_numlt(fltvalue(l), fltvalue(r));
+  else
+    return luaV_lessthan(L, l, r);
+}
+
+
+/*
+** Stable merge sort of numbers or strings (which compare without
+** metamethods or errors); 'temp' has room for 'n / 2' values
+*/
+static void sortvalues (lua_State *L, TValue *a, TValue *temp,
+                        unsigned int n) {
+  if (n <= SORTRUN) {  /* insertion sort */
+    unsigned int i, j;
+    for (i = 1; i < n; i++) {
+      TValue v;
+      setobj(L, &v, &a[i]);
+      for (j = i; j > 0 && sortlt(L, &v, &a[j - 1]); j--)
+        setobj(L, &a[j], &a[j - 1]);
+      setobj(L, &a[j], &v);
+    }
+  }
+  else {
+    unsigned int m = n / 2;
+    unsigned int i = 0, j = m, k = 0;
+    sortvalues(L, a, temp, m);
+    sortvalues(L, a + m, temp, n - m);
+    if (!sortlt(L, &a[m], &a[m - 1]))
+      return;  /* halves are already in order */
+    memcpy(temp, a, m * sizeof(TValue));
+    while (i < m && j < n) {  /* merge 'temp' and upper half into 'a' */
+      if (sortlt(L, &a[j], &temp[i])) {
+        setobj(L, &a[k], &a[j]); j++;
+      }
+      else {
+        setobj(L, &a[k], &temp[i]); i++;
+      }
+      k++;
+    }
+    memcpy(a + k, temp + i, (m - i) * sizeof(TValue));
+  }
+}
+
+
+/*
+** Sort the first 'n' elements of the array part of 't' in ascending
+** order, if they are all numbers (but not NaN) or all strings, and
+** return 1; otherwise leave the array alone and return 0. The sort is
+** stable. The values only move inside the array, so no barriers are
+** needed; nothing is allocated while values are out of the array, so
+** the collector never sees them missing.
+*/
+int luaH_sortarray (lua_State *L, Table *t, lua_Unsigned n) {
+  TValue *a = t->array;
+  int allint = 1, allnum = 1, allstr = 1;
+  unsigned int i;
+  if (n > t->sizearray)
+    return 0;
+  for (i = 0; i < n && (allnum || allstr); i++) {
+    const TValue *v = &a[i];
+    if (!ttisinteger(v)) {
+      allint = 0;
+      if (!ttisfloat(v) || luai_numisnan(fltvalue(v)))
+        allnum = 0;
+    }
+    if (ttisstring(v))
+      luaS_tocstr(L, tsvalue(v));  /* flatten it now; comparisons need it */
+    else
+      allstr = 0;
+  }
+  if (n < 2)
+    return allnum || allstr;
+  else if (allint)
+    sortints(L, a, cast(unsigned int, n));
+  else if (allnum || allstr) {
+    size_t tsize = cast(size_t, n / 2);
+    TValue *temp = luaM_newvector(L, tsize, TValue);
+    sortvalues(L, a, temp, cast(unsigned int, n));
+    luaM_freearray(L, temp, tsize);
+  }
+  else
+    return 0;
+  return 1;
+}
+
+/* }====================================================== */
+
+
 #if defined(LUA_DEBUG)
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
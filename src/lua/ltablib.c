@@ -185,6 +185,31 @@ static int tconcat (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Create/clear
+** =======================================================
+*/
+
+static int tcreate (lua_State *L) {
+  lua_Integer narr = luaL_checkinteger(L, 1);
+  lua_Integer nrec = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, 0 <= narr && narr <= INT_MAX, 1, "out of range");
+  luaL_argcheck(L, 0 <= nrec && nrec <= INT_MAX, 2, "out of range");
+  lua_createtable(L, (int)narr, (int)nrec);
+  return 1;
+}
+
+
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Pack/unpack
@@ -415,7 +440,95 @@ static int sort (lua_State *L) {
     if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
       luaL_checktype(L, 2, LUA_TFUNCTION);  /* must be a function */
     lua_settop(L, 2);  /* make sure there are two arguments */
-    auxsort(L, 1, (IdxT)n, 0);
+    if (!lua_isnil(L, 2) || !lua_sortarray(L, 1, n))  /* no fast path? */
+      auxsort(L, 1, (IdxT)n, 0);
+  }
+  return 0;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Stable sort (bottom-up merge sort between two scratch tables)
+** =======================================================
+*/
+
+
+/*
+** Merge the sorted runs [lo, mid) and [mid, up) of the table at index
+** 'from' into the same positions of the table at index 'to'. While both
+** runs have elements, their heads are on the stack (left one below).
+*/
+static void merge (lua_State *L, int from, int to, lua_Integer lo,
+                   lua_Integer mid, lua_Integer up) {
+  lua_Integer i = lo, j = mid, k = lo;
+  if (i < mid && j < up) {
+    lua_rawgeti(L, from, i);
+    lua_rawgeti(L, from, j);
+    for (;;) {
+      if (sort_comp(L, -1, -2)) {  /* right head < left head? */
+        lua_rawseti(L, to, k++);  /* move right head */
+        if (++j == up) break;
+        lua_rawgeti(L, from, j);
+      }
+      else {  /* left one goes first (which keeps the sort stable) */
+        lua_rotate(L, -2, 1);
+        lua_rawseti(L, to, k++);  /* move left head */
+        if (++i == mid) break;
+        lua_rawgeti(L, from, i);
+        lua_rotate(L, -2, 1);
+      }
+    }
+    lua_pop(L, 1);  /* remaining head (copied below) */
+  }
+  for (; i < mid; i++) {
+    lua_rawgeti(L, from, i);
+    lua_rawseti(L, to, k++);
+  }
+  for (; j < up; j++) {
+    lua_rawgeti(L, from, j);
+    lua_rawseti(L, to, k++);
+  }
+}
+
+
+/*
+** Like 'sort', but keeps equal elements in their original order. The
+** list itself is only written at the end, so an error in the order
+** function leaves it untouched.
+*/
+static int stablesort (lua_State *L) {
+  lua_Integer n = aux_getn(L, 1, TAB_RW);
+  if (n > 1) {  /* non-trivial interval? */
+    lua_Integer i, width;
+    int from = 3, to = 4;
+    luaL_argcheck(L, n < INT_MAX, 1, "array too big");
+    if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
+      luaL_checktype(L, 2, LUA_TFUNCTION);  /* must be a function */
+    lua_settop(L, 2);  /* make sure there are two arguments */
+    if (lua_isnil(L, 2) && lua_sortarray(L, 1, n))  /* fast path? */
+      return 0;
+    lua_createtable(L, (int)n, 0);
+    lua_createtable(L, (int)n, 0);
+    for (i = 1; i <= n; i++) {
+      lua_geti(L, 1, i);
+      lua_rawseti(L, from, i);
+    }
+    for (width = 1; width < n; width *= 2) {
+      int temp;
+      for (i = 1; i <= n; i += 2 * width) {
+        lua_Integer mid = (n - i < width) ? n + 1 : i + width;
+        lua_Integer up = (n - i < 2 * width) ? n + 1 : i + 2 * width;
+        merge(L, from, to, i, mid, up);
+      }
+      temp = from; from = to; to = temp;
+    }
+    for (i = 1; i <= n; i++) {
+      lua_rawgeti(L, from, i);
+      lua_seti(L, 1, i);
+    }
   }
   return 0;
 }
@@ -425,6 +538,8 @@ static int sort (lua_State *L) {
 
 static const luaL_Reg tab_funcs[] = {
   {"concat", tconcat},
+  {"create", tcreate},
+  {"clear", tclear},
 #if defined(LUA_COMPAT_MAXN)
   {"maxn", maxn},
 #endif
@@ -434,6 +549,7 @@ static const luaL_Reg tab_funcs[] = {
   {"remove", tremove},
   {"move", tmove},
   {"sort", sort},
+  {"stablesort", stablesort},
   {NULL, NULL}
 };
 
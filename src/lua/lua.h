@@ -79,6 +79,10 @@ typedef struct lua_State lua_State;
 #define LUA_MINSTACK	20
 
 
+/* size of a buffer for 'lua_numbertobuff' */
+#define LUA_MAXNUMBER2STR	50
+
+
 /* predefined values in the registry */
 #define LUA_RIDX_MAINTHREAD	1
 #define LUA_RIDX_GLOBALS	2
@@ -162,6 +166,7 @@ LUA_API void  (lua_pushvalue) (lua_State *L, int idx);
 LUA_API void  (lua_rotate) (lua_State *L, int idx, int n);
 LUA_API void  (lua_copy) (lua_State *L, int fromidx, int toidx);
 LUA_API int   (lua_checkstack) (lua_State *L, int n);
+LUA_API int   (lua_reservestack) (lua_State *L, int n, int ncalls);
 
 LUA_API void  (lua_xmove) (lua_State *from, lua_State *to, int n);
 
@@ -182,6 +187,7 @@ LUA_API lua_Number      (lua_tonumberx) (lua_State *L, int idx, int *isnum);
 LUA_API lua_Integer     (lua_tointegerx) (lua_State *L, int idx, int *isnum);
 LUA_API int             (lua_toboolean) (lua_State *L, int idx);
 LUA_API const char     *(lua_tolstring) (lua_State *L, int idx, size_t *len);
+LUA_API size_t          (lua_numbertobuff) (lua_State *L, int idx, char *buff);
 LUA_API size_t          (lua_rawlen) (lua_State *L, int idx);
 LUA_API lua_CFunction   (lua_tocfunction) (lua_State *L, int idx);
 LUA_API void	       *(lua_touserdata) (lua_State *L, int idx);
@@ -308,10 +314,62 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
 #define LUA_GCISRUNNING		9
+#define LUA_GCSETIDLE		12
+#define LUA_GCIDLESTEP		13
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
 
+/*
+** garbage-collection statistics; times are in nanoseconds and
+** histogram bucket 'i' counts pauses shorter than 2^i microseconds
+** (the last bucket also gets all longer pauses)
+*/
+#define LUA_GCSTATBUCKETS	24
+
+typedef struct lua_GCStats {
+  size_t cycles;  /* completed collection cycles */
+  size_t fullcycles;  /* cycles done by full (atomic) collections */
+  size_t steps;  /* incremental steps */
+  size_t atomics;  /* atomic phases */
+  size_t finalizers;  /* finalizers ('__gc' metamethods) called */
+  size_t bytesfreed;  /* bytes released by the sweep phases */
+  double steptime;  /* time spent in incremental steps */
+  double atomictime;  /* time spent in atomic phases */
+  double fintime;  /* time spent running finalizers */
+  double fulltime;  /* time spent in full collections */
+  size_t idlesteps;  /* steps done through 'LUA_GCIDLESTEP' */
+  double idletime;  /* time spent in those steps */
+  double maxstep;  /* longest incremental step */
+  double maxatomic;  /* longest atomic phase */
+  size_t stephist[LUA_GCSTATBUCKETS];  /* incremental step pauses */
+  size_t atomichist[LUA_GCSTATBUCKETS];  /* atomic phase pauses */
+  int pause;  /* current value of 'LUA_GCSETPAUSE' */
+  int stepmul;  /* current value of 'LUA_GCSETSTEPMUL' */
+} lua_GCStats;
+
+LUA_API void (lua_gcstats) (lua_State *L, lua_GCStats *stats, int reset);
+
+
+/*
+** per-function call statistics, collected while 'lua_callstats' is
+** on; times are in nanoseconds
+*/
+typedef struct lua_FuncStats {
+  const char *source;  /* as 'short_src' in 'lua_Debug' */
+  int linedefined;
+  size_t calls;
+  double selftime;  /* time not spent in called Lua functions */
+  double totaltime;  /* time from calls to returns */
+} lua_FuncStats;
+
+typedef void (*lua_FuncStatsF) (void *ud, const lua_FuncStats *stats);
+
+LUA_API int (lua_callstats) (lua_State *L, int on);
+LUA_API void (lua_funcstats) (lua_State *L, lua_FuncStatsF f, void *ud,
+                              int reset);
+
+
 /*
 ** miscellaneous functions
 */
@@ -319,6 +377,8 @@ LUA_API int (lua_gc) (lua_State *L, int what, int data);
 LUA_API int   (lua_error) (lua_State *L);
 
 LUA_API int   (lua_next) (lua_State *L, int idx);
+LUA_API int   (lua_sortarray) (lua_State *L, int idx, lua_Integer n);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
 
 LUA_API void  (lua_concat) (lua_State *L, int n);
 LUA_API void  (lua_len)    (lua_State *L, int idx);
@@ -328,6 +388,8 @@ LUA_API size_t   (lua_stringtonumber) (lua_State *L, const char *s);
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void      (lua_setallocf) (lua_State *L, lua_Alloc f, void *ud);
 
+LUA_API int   (lua_setjit) (lua_State *L, int on);
+
 
 
 /*
@@ -31,6 +31,7 @@ static void PrintFunction(const Proto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int optimizing=0;		/* optimize generated code? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -58,6 +59,7 @@ static void usage(const char* message)
   "Available options are:\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
+  "  -O       optimize generated code\n"
   "  -p       parse only\n"
   "  -s       strip debug information\n"
   "  -v       show version information\n"
@@ -95,6 +97,8 @@ static int doargs(int argc, char* argv[])
     usage("'-o' needs argument");
    if (IS("-")) output=NULL;
   }
+  else if (IS("-O"))			/* optimize */
+   optimizing=1;
   else if (IS("-p"))			/* parse only */
    dumping=0;
   else if (IS("-s"))			/* strip debug information */
@@ -172,7 +176,8 @@ static int pmain(lua_State* L)
  for (i=0; i<argc; i++)
  {
   const char* filename=IS("-") ? NULL : argv[i];
-  if (luaL_loadfile(L,filename)!=LUA_OK) fatal(lua_tostring(L,-1));
+  if (luaL_loadfilex(L,filename,optimizing ? "bto" : NULL)!=LUA_OK)
+   fatal(lua_tostring(L,-1));
  }
  f=combine(L,argc);
  if (listing) luaU_print(f,listing>1);
@@ -332,6 +337,7 @@ static void PrintCode(const Proto* f)
     printf("\t; %s",UPVALNAME(b));
     break;
    case OP_GETTABUP:
+   case OP_GETTABUPTAB:
     printf("\t; %s",UPVALNAME(b));
     if (ISK(c)) { printf(" "); PrintConstant(f,INDEXK(c)); }
     break;
@@ -346,6 +352,7 @@ static void PrintCode(const Proto* f)
     break;
    case OP_SETTABLE:
    case OP_ADD:
+   case OP_ADDFORLOOP:
    case OP_SUB:
    case OP_MUL:
    case OP_MOD:
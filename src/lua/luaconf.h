@@ -36,6 +36,36 @@
 /* #define LUA_32BITS */
 
 
+/*
+@@ LUA_NANBOXING packs every Lua value into a single NaN-boxed 64-bit
+** word instead of a value+tag pair, halving the size of stacks, array
+** parts and table nodes. It is only available on x86-64, and it makes
+** Lua integers 32-bit (they must fit in the boxed payload).
+*/
+/* #define LUA_NANBOXING */
+
+#if defined(LUA_NANBOXING) && !(defined(__x86_64__) || defined(_M_X64))
+#error "LUA_NANBOXING is only supported on x86-64"
+#endif
+
+
+/*
+@@ LUA_USE_JIT compiles hot Lua functions to x86-64 machine code (see
+** ljit.c). It needs Linux and gcc (or a compatible compiler), and it
+** does not support LUA_NANBOXING or LUA_32BITS.
+*/
+/* #define LUA_USE_JIT */
+
+#if defined(LUA_USE_JIT) && \
+    !(defined(__x86_64__) && defined(__linux__) && defined(__GNUC__))
+#error "LUA_USE_JIT is only supported on x86-64 Linux with gcc"
+#endif
+
+#if defined(LUA_USE_JIT) && (defined(LUA_NANBOXING) || defined(LUA_32BITS))
+#error "LUA_USE_JIT does not support LUA_NANBOXING or LUA_32BITS"
+#endif
+
+
 /*
 @@ LUA_USE_C89 controls the use of non-ISO-C89 features.
 ** Define it if you want Lua to avoid the use of a few C99 features
@@ -72,6 +102,17 @@
 #endif
 
 
+/*
+@@ LUA_USE_SIMD enables the SSE4.2/AVX2 versions of string hashing and
+** plain search, selected at run time according to the CPU, and the
+** SSE2 scanning of comments, blanks and strings in the lexer. It needs
+** x86-64 and GCC or Clang; define LUA_NOSIMD to use only portable code.
+*/
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(LUA_NOSIMD)
+#define LUA_USE_SIMD
+#endif
+
+
 /*
 @@ LUA_C89_NUMBERS ensures that Lua uses the largest types available for
 ** C89 ('long' and 'double'); Windows always has '__int64', so it does
@@ -126,6 +167,13 @@
 #endif
 #define LUA_FLOAT_TYPE	LUA_FLOAT_FLOAT
 
+#elif defined(LUA_NANBOXING)	/* }{ */
+/*
+** 32-bit integers and 'double' (what fits in a NaN-boxed value)
+*/
+#define LUA_INT_TYPE	LUA_INT_INT
+#define LUA_FLOAT_TYPE	LUA_FLOAT_DOUBLE
+
 #elif defined(LUA_C89_NUMBERS)	/* }{ */
 /*
 ** largest types available for C89 ('long' and 'double')
@@ -653,6 +701,25 @@
 #endif
 
 
+/*
+@@ LUA_USE_FASTNUM makes Lua convert numbers to and from strings with
+** its own routines (in lobject.c) instead of 'snprintf' and 'strtod'.
+** They give the same results, handing the hard cases to the C library.
+** They need the default number types and float format; define
+** LUA_NOFASTNUM to use only the C library.
+*/
+#if LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && \
+    LUA_INT_TYPE == LUA_INT_LONGLONG && !defined(LUA_NOFASTNUM)
+#define LUA_USE_FASTNUM
+#undef lua_number2str
+#undef lua_integer2str
+#undef lua_str2number
+#define lua_number2str(s,sz,n)	luaO_num2str(s,sz,n)
+#define lua_integer2str(s,sz,n)	luaO_int2str(s,sz,n)
+#define lua_str2number(s,p)	luaO_str2number(s,p)
+#endif
+
+
 /*
 @@ LUA_KCONTEXT is the type of the context ('ctx') for continuation
 ** functions.  It must be a numerical type; Lua will use 'intptr_t' if
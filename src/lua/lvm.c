@@ -22,6 +22,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -31,6 +32,19 @@
 #include "lvm.h"
 
 
+/*
+** By default, use jump tables in the main interpreter loop on gcc
+** and compatible compilers.
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+
 /* limit for table tag-method chains (to avoid loops) */
 #define MAXTAGLOOP	2000
 
@@ -65,6 +79,24 @@
 
 
 
+/*
+** Check whether string value 'obj' is a numeral, putting its value in
+** 'v'. A long string sharing a block with longer strings is not followed
+** by a '\0', which 'luaO_str2num' needs; one is put there just for the
+** conversion.
+*/
+static int l_str2num (const TValue *obj, TValue *v) {
+  char *s = svalue(obj);
+  size_t l = vslen(obj);
+  size_t res;
+  char c = s[l];
+  s[l] = '\0';
+  res = luaO_str2num(s, v);
+  s[l] = c;
+  return (res == l + 1);
+}
+
+
 /*
 ** Try to convert a value to a float. The float case is already handled
 ** by the macro 'tonumber'.
@@ -76,7 +108,7 @@ int luaV_tonumber_ (const TValue *obj, lua_Number *n) {
     return 1;
   }
   else if (cvt2num(obj) &&  /* string convertible to number? */
-            luaO_str2num(svalue(obj), &v) == vslen(obj) + 1) {
+            l_str2num(obj, &v)) {
     *n = nvalue(&v);  /* convert result of 'luaO_str2num' to a float */
     return 1;
   }
@@ -108,8 +140,7 @@ int luaV_tointeger (const TValue *obj, lua_Integer *p, int mode) {
     *p = ivalue(obj);
     return 1;
   }
-  else if (cvt2num(obj) &&
-            luaO_str2num(svalue(obj), &v) == vslen(obj) + 1) {
+  else if (cvt2num(obj) && l_str2num(obj, &v)) {
     obj = &v;
     goto again;  /* convert result from 'luaO_str2num' to an integer */
   }
@@ -245,10 +276,10 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
 ** and it uses 'strcoll' (to respect locales) for each segments
 ** of the strings.
 */
-static int l_strcmp (const TString *ls, const TString *rs) {
-  const char *l = getstr(ls);
+static int l_strcmp (lua_State *L, TString *ls, TString *rs) {
+  const char *l = luaS_tocstr(L, ls);
   size_t ll = tsslen(ls);
-  const char *r = getstr(rs);
+  const char *r = luaS_tocstr(L, rs);
   size_t lr = tsslen(rs);
   for (;;) {  /* for each segment */
     int temp = strcoll(l, r);
@@ -366,7 +397,7 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   if (ttisnumber(l) && ttisnumber(r))  /* both operands are numbers? */
     return LTnum(l, r);
   else if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) < 0;
   else if ((res = luaT_callorderTM(L, l, r, TM_LT)) < 0)  /* no metamethod? */
     luaG_ordererror(L, l, r);  /* error */
   return res;
@@ -386,7 +417,7 @@ int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r) {
   if (ttisnumber(l) && ttisnumber(r))  /* both operands are numbers? */
     return LEnum(l, r);
   else if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) <= 0;
   else if ((res = luaT_callorderTM(L, l, r, TM_LE)) >= 0)  /* try 'le' */
     return res;
   else {  /* try 'lt': */
@@ -499,6 +530,11 @@ void luaV_concat (lua_State *L, int total) {
         copy2buff(top, n, buff);  /* copy strings to buffer */
         ts = luaS_newlstr(L, buff, tl);
       }
+      else if (ttislngstring(top - n)) {  /* appending to a long string? */
+        size_t l = vslen(top - n);
+        ts = luaS_extend(L, tsvalue(top - n), tl);
+        copy2buff(top, n - 1, getstr(ts) + l);  /* copy the other strings */
+      }
       else {  /* long string; copy strings directly to final result */
         ts = luaS_createlngstrobj(L, tl);
         copy2buff(top, n, getstr(ts));
@@ -657,13 +693,16 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->u.l.base;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = genericop(GET_OPCODE(inst));  /* (may have been quickened) */
   switch (op) {  /* finish its execution */
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV:
     case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
     case OP_MOD: case OP_POW:
     case OP_UNM: case OP_BNOT: case OP_LEN:
-    case OP_GETTABUP: case OP_GETTABLE: case OP_SELF: {
+    case OP_GETTABUP: case OP_GETTABLE: case OP_SELF:
+    case OP_GETTABUPTAB: case OP_ADDFORLOOP: {
+      /* a superinstruction yields only in its first part (OP_GETTABUP or
+         OP_ADD); its second part is the next instruction, run on resume */
       setobjs2s(L, base + GETARG_A(inst), --L->top);
       break;
     }
@@ -767,6 +806,40 @@ void luaV_finishOp (lua_State *L) {
 #define vmbreak		break
 
 
+/*
+** In a superinstruction, go on executing the next instruction (which
+** must be 'o') at label 'lbl', unless hooks need to see it.
+*/
+#define vmfuse(o,lbl)	\
+  if (!(L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT))) { \
+    i = *(ci->u.l.savedpc++); \
+    ra = RA(i); \
+    lua_assert(genericop(GET_OPCODE(i)) == o); \
+    goto lbl; \
+  }
+
+
+/*
+** Method lookup for OP_SELF when 'key' is not in 't' itself: if the
+** '__index' metamethod of 't' is a table holding 'key', return its
+** value (what 'luaV_finishget' would find); otherwise return NULL.
+*/
+static const TValue *indexmethod (lua_State *L, const TValue *t,
+                                  TString *key, unsigned int *hint) {
+  const TValue *tm;
+  if (ttistable(t))
+    tm = fasttm(L, hvalue(t)->metatable, TM_INDEX);
+  else
+    tm = luaT_gettmbyobj(L, t, TM_INDEX);
+  if (tm != NULL && ttistable(tm)) {
+    const TValue *res = luaH_getshortstrhint(hvalue(tm), key, hint);
+    if (!ttisnil(res))
+      return res;
+  }
+  return NULL;
+}
+
+
 /*
 ** copy of 'luaV_gettable', but protecting the call to potential
 ** metamethod (which can reallocate the stack)
@@ -776,6 +849,84 @@ void luaV_finishOp (lua_State *L) {
   else Protect(luaV_finishget(L,t,k,v,slot)); }
 
 
+/* index of the current instruction */
+#define curpc()	(ci->u.l.savedpc - cl->p->code - 1)
+
+/*
+** inline cache of the current instruction (see 'luaH_getshortstrhint')
+*/
+#define hint()	(cl->p->hints + curpc())
+
+#define gethint(h,key)	luaH_getshortstrhint(h, key, hint())
+
+
+/* 'gettableProtected' using the inline cache for short-string keys */
+#define gettableCached(L,t,k,v)  { const TValue *slot; \
+  if (ttisshrstring(k) ? luaV_fastget(L,t,tsvalue(k),slot,gethint) \
+                       : luaV_fastget(L,t,k,slot,luaH_get)) \
+    { setobj2s(L, v, slot); } \
+  else Protect(luaV_finishget(L,t,k,v,slot)); }
+
+
+/*
+** Quickening (see 'lopcodes.h'): generic instruction 'o' rewrites itself
+** into 'q' when its operands suit it. A quickened instruction whose
+** operands do not suit it any more goes back to 'o' (at label 'lbl'),
+** counting the failure in its inline cache; after QUICKENLIMIT
+** failures the instruction stays generic.
+*/
+#define QUICKENLIMIT	4
+
+#define quicken(o,q)  \
+  { if (GET_OPCODE(i) == o && *hint() < QUICKENLIMIT)  \
+      SET_OPCODE(cl->p->code[curpc()], q); }
+
+#define unquicken(o,lbl)  \
+  { (*hint())++; SET_OPCODE(cl->p->code[curpc()], o); goto lbl; }
+
+
+/*
+** Compiled code (see 'ljit.c') is entered at the start of frames (on
+** calls and returns) and at backward jumps, which are also what counts
+** towards compiling a function.
+*/
+#if defined(LUA_USE_JIT)
+#define jitenter()  { Proto *p_ = cl->p; \
+  if (p_->jit != NULL) luaJ_run(L, ci, p_); \
+  else if (p_->jitcount > 0 && --p_->jitcount == 0) luaJ_compile(L, p_); }
+#else
+#define jitenter()	((void)0)
+#endif
+
+
+/* quickened arithmetic with integer or float operands */
+#define arithII(op,o,lbl)  { TValue *rb = RKB(i); TValue *rc = RKC(i); \
+  if (ttisinteger(rb) && ttisinteger(rc)) { \
+    lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc); \
+    setivalue(ra, intop(op, ib, ic)); } \
+  else unquicken(o, lbl); }
+
+#define arithFF(numop,o,lbl)  { TValue *rb = RKB(i); TValue *rc = RKC(i); \
+  if (ttisfloat(rb) && ttisfloat(rc)) { \
+    setfltvalue(ra, numop(L, fltvalue(rb), fltvalue(rc))); } \
+  else unquicken(o, lbl); }
+
+
+/* quickened comparisons with integer or float operands */
+#define compareII(op,o,lbl)  { TValue *rb = RKB(i); TValue *rc = RKC(i); \
+  if (ttisinteger(rb) && ttisinteger(rc)) { \
+    if ((ivalue(rb) op ivalue(rc)) != GETARG_A(i)) ci->u.l.savedpc++; \
+    else donextjump(ci); } \
+  else unquicken(o, lbl); }
+
+#define compareFF(numop,o,lbl)  { TValue *rb = RKB(i); TValue *rc = RKC(i); \
+  if (ttisfloat(rb) && ttisfloat(rc)) { \
+    if (numop(fltvalue(rb), fltvalue(rc)) != GETARG_A(i)) \
+      ci->u.l.savedpc++; \
+    else donextjump(ci); } \
+  else unquicken(o, lbl); }
+
+
 /* same for 'luaV_settable' */
 #define settableProtected(L,t,k,v) { const TValue *slot; \
   if (!luaV_fastset(L,t,k,slot,luaH_get,v)) \
@@ -788,12 +939,16 @@ void luaV_execute (lua_State *L) {
   LClosure *cl;
   TValue *k;
   StkId base;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
   ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
   cl = clLvalue(ci->func);  /* local reference to function's closure */
   k = cl->p->k;  /* local reference to function's constant table */
   base = ci->u.l.base;  /* local copy of function's base */
+  jitenter();
   /* main loop of interpreter */
   for (;;) {
     Instruction i;
@@ -833,16 +988,19 @@ void luaV_execute (lua_State *L) {
         setobj2s(L, ra, cl->upvals[b]->v);
         vmbreak;
       }
-      vmcase(OP_GETTABUP) {
+      vmcase(OP_GETTABUP)
+      vmcase(OP_GETTABUPTAB) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v;
         TValue *rc = RKC(i);
-        gettableProtected(L, upval, rc, ra);
+        gettableCached(L, upval, rc, ra);
+        if (GET_OPCODE(i) == OP_GETTABUPTAB)
+          vmfuse(OP_GETTABLE, l_gettable);
         vmbreak;
       }
-      vmcase(OP_GETTABLE) {
+      vmcase(OP_GETTABLE) l_gettable: {
         StkId rb = RB(i);
         TValue *rc = RKC(i);
-        gettableProtected(L, rb, rc, ra);
+        gettableCached(L, rb, rc, ra);
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -879,51 +1037,72 @@ void luaV_execute (lua_State *L) {
         StkId rb = RB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rc);  /* key must be a string */
+        int isshort = (key->tt == LUA_TSHRSTR);
         setobjs2s(L, ra + 1, rb);
-        if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
+        if (isshort ? luaV_fastget(L, rb, key, aux, gethint)
+                    : luaV_fastget(L, rb, key, aux, luaH_getstr)) {
           setobj2s(L, ra, aux);
         }
+        else if (isshort) {
+          const TValue *m = indexmethod(L, rb, key, hint());
+          if (m != NULL) {
+            setobj2s(L, ra, m);
+          }
+          else Protect(luaV_finishget(L, rb, rc, ra, aux));
+        }
         else Protect(luaV_finishget(L, rb, rc, ra, aux));
         vmbreak;
       }
-      vmcase(OP_ADD) {
+      vmcase(OP_ADD)
+      vmcase(OP_ADDFORLOOP) l_add: {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         lua_Number nb; lua_Number nc;
         if (ttisinteger(rb) && ttisinteger(rc)) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
           setivalue(ra, intop(+, ib, ic));
+          quicken(OP_ADD, OP_ADDII);
         }
         else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
           setfltvalue(ra, luai_numadd(L, nb, nc));
+          if (ttisfloat(rb) && ttisfloat(rc))
+            quicken(OP_ADD, OP_ADDFF);
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_ADD)); }
+        if (GET_OPCODE(i) == OP_ADDFORLOOP)
+          vmfuse(OP_FORLOOP, l_forloop);
         vmbreak;
       }
-      vmcase(OP_SUB) {
+      vmcase(OP_SUB) l_sub: {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         lua_Number nb; lua_Number nc;
         if (ttisinteger(rb) && ttisinteger(rc)) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
           setivalue(ra, intop(-, ib, ic));
+          quicken(OP_SUB, OP_SUBII);
         }
         else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
           setfltvalue(ra, luai_numsub(L, nb, nc));
+          if (ttisfloat(rb) && ttisfloat(rc))
+            quicken(OP_SUB, OP_SUBFF);
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_SUB)); }
         vmbreak;
       }
-      vmcase(OP_MUL) {
+      vmcase(OP_MUL) l_mul: {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         lua_Number nb; lua_Number nc;
         if (ttisinteger(rb) && ttisinteger(rc)) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
           setivalue(ra, intop(*, ib, ic));
+          quicken(OP_MUL, OP_MULII);
         }
         else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
           setfltvalue(ra, luai_nummul(L, nb, nc));
+          if (ttisfloat(rb) && ttisfloat(rc))
+            quicken(OP_MUL, OP_MULFF);
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_MUL)); }
         vmbreak;
@@ -1079,6 +1258,8 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_JMP) {
         dojump(ci, i, 0);
+        if (GETARG_sBx(i) < 0)
+          jitenter();
         vmbreak;
       }
       vmcase(OP_EQ) {
@@ -1092,18 +1273,34 @@ void luaV_execute (lua_State *L) {
         )
         vmbreak;
       }
-      vmcase(OP_LT) {
+      vmcase(OP_LT) l_lt: {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisinteger(rb) && ttisinteger(rc)) {
+          quicken(OP_LT, OP_LTII);
+        }
+        else if (ttisfloat(rb) && ttisfloat(rc)) {
+          quicken(OP_LT, OP_LTFF);
+        }
         Protect(
-          if (luaV_lessthan(L, RKB(i), RKC(i)) != GETARG_A(i))
+          if (luaV_lessthan(L, rb, rc) != GETARG_A(i))
             ci->u.l.savedpc++;
           else
             donextjump(ci);
         )
         vmbreak;
       }
-      vmcase(OP_LE) {
+      vmcase(OP_LE) l_le: {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisinteger(rb) && ttisinteger(rc)) {
+          quicken(OP_LE, OP_LEII);
+        }
+        else if (ttisfloat(rb) && ttisfloat(rc)) {
+          quicken(OP_LE, OP_LEFF);
+        }
         Protect(
-          if (luaV_lessequal(L, RKB(i), RKC(i)) != GETARG_A(i))
+          if (luaV_lessequal(L, rb, rc) != GETARG_A(i))
             ci->u.l.savedpc++;
           else
             donextjump(ci);
@@ -1166,6 +1363,13 @@ void luaV_execute (lua_State *L) {
           oci->u.l.base = ofunc + (nci->u.l.base - nfunc);  /* correct base */
           oci->top = L->top = ofunc + (L->top - nfunc);  /* correct top */
           oci->u.l.savedpc = nci->u.l.savedpc;
+          if (oci->callstatus & CIST_TIMED)
+            luaD_endcall(oci);  /* caller is done */
+          if (nci->callstatus & CIST_TIMED) {  /* keep timing the callee */
+            oci->callstatus |= CIST_TIMED;
+            oci->tstart = nci->tstart;
+            oci->tchild = 0;
+          }
           oci->callstatus |= CIST_TAIL;  /* function was tail called */
           ci = L->ci = oci;  /* remove new frame */
           lua_assert(L->top == oci->u.l.base + getproto(ofunc)->maxstacksize);
@@ -1187,15 +1391,18 @@ void luaV_execute (lua_State *L) {
           goto newframe;  /* restart luaV_execute over new Lua function */
         }
       }
-      vmcase(OP_FORLOOP) {
+      vmcase(OP_FORLOOP) l_forloop: {
         if (ttisinteger(ra)) {  /* integer loop? */
           lua_Integer step = ivalue(ra + 2);
           lua_Integer idx = intop(+, ivalue(ra), step); /* increment index */
           lua_Integer limit = ivalue(ra + 1);
+          if (0 < step)
+            quicken(OP_FORLOOP, OP_FORLOOPI);
           if ((0 < step) ? (idx <= limit) : (limit <= idx)) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgivalue(ra, idx);  /* update internal index... */
             setivalue(ra + 3, idx);  /* ...and external index */
+            jitenter();
           }
         }
         else {  /* floating loop */
@@ -1207,6 +1414,7 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgfltvalue(ra, idx);  /* update internal index... */
             setfltvalue(ra + 3, idx);  /* ...and external index */
+            jitenter();
           }
         }
         vmbreak;
@@ -1257,6 +1465,7 @@ void luaV_execute (lua_State *L) {
         if (!ttisnil(ra + 1)) {  /* continue loop? */
           setobjs2s(L, ra, ra + 1);  /* save control variable */
            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+           jitenter();
         }
         vmbreak;
       }
@@ -1314,6 +1523,59 @@ void luaV_execute (lua_State *L) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_ADDII) {
+        arithII(+, OP_ADD, l_add);
+        vmbreak;
+      }
+      vmcase(OP_ADDFF) {
+        arithFF(luai_numadd, OP_ADD, l_add);
+        vmbreak;
+      }
+      vmcase(OP_SUBII) {
+        arithII(-, OP_SUB, l_sub);
+        vmbreak;
+      }
+      vmcase(OP_SUBFF) {
+        arithFF(luai_numsub, OP_SUB, l_sub);
+        vmbreak;
+      }
+      vmcase(OP_MULII) {
+        arithII(*, OP_MUL, l_mul);
+        vmbreak;
+      }
+      vmcase(OP_MULFF) {
+        arithFF(luai_nummul, OP_MUL, l_mul);
+        vmbreak;
+      }
+      vmcase(OP_LTII) {
+        compareII(<, OP_LT, l_lt);
+        vmbreak;
+      }
+      vmcase(OP_LTFF) {
+        compareFF(luai_numlt, OP_LT, l_lt);
+        vmbreak;
+      }
+      vmcase(OP_LEII) {
+        compareII(<=, OP_LE, l_le);
+        vmbreak;
+      }
+      vmcase(OP_LEFF) {
+        compareFF(luai_numle, OP_LE, l_le);
+        vmbreak;
+      }
+      vmcase(OP_FORLOOPI) {
+        if (ttisinteger(ra) && 0 < ivalue(ra + 2)) {  /* still counting up? */
+          lua_Integer idx = intop(+, ivalue(ra), ivalue(ra + 2));
+          if (idx <= ivalue(ra + 1)) {
+            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+            chgivalue(ra, idx);  /* update internal index... */
+            setivalue(ra + 3, idx);  /* ...and external index */
+            jitenter();
+          }
+        }
+        else unquicken(OP_FORLOOP, l_forloop);
+        vmbreak;
+      }
     }
   }
 }
@@ -56,6 +56,17 @@ v8::Local<v8::Value> ValueFromLuaObject(v8::Isolate *isolate, lua_State *L, int
             }
             return obj;
         }
+        case LUA_TUSERDATA: {
+            // a strbuf becomes a string made straight from its memory
+            size_t len;
+            const char *value = luaL_tostrbuf(L, index, &len);
+            v8::Local<v8::String> str;
+            if (value != NULL && len <= static_cast<size_t>(v8::String::kMaxLength) &&
+                v8::String::NewFromUtf8(isolate, value, NewStringType::kNormal, static_cast<int>(len)).ToLocal(&str)) {
+                return str;
+            }
+            return v8::Local<v8::Primitive>::New(isolate, v8::Undefined(isolate));
+        }
         default: {
             return v8::Local<v8::Primitive>::New(isolate, v8::Undefined(isolate));
         }
@@ -0,0 +1,257 @@
+//
+// Sampling profiler for a LuaState (see LuaState#startProfiling)
+//
+
+#include <algorithm>
+#include <string.h>
+#include "luaprofiler.h"
+#include <nan.h>
+
+using namespace v8;
+
+// frames deeper than this (counting from the innermost one) are dropped
+#define MAX_SAMPLE_DEPTH 128
+
+namespace luajs {
+
+  Profiler::Profiler(lua_State *L)
+    : L_(L), running_(false), stopping_(false), intervalUs_(0),
+      startTime_(0), endTime_(0)
+  {
+    uv_mutex_init(&mutex_);
+    uv_cond_init(&cond_);
+  }
+
+  Profiler::~Profiler()
+  {
+    Stop();
+    uv_cond_destroy(&cond_);
+    uv_mutex_destroy(&mutex_);
+  }
+
+  void Profiler::Start(int intervalUs)
+  {
+    if (running_)
+    {
+      return;
+    }
+
+    Node root;
+    root.name = "(root)";
+    root.line = 0;
+    root.parent = -1;
+    root.hits = 0;
+    nodes_.assign(1, root);
+    samples_.clear();
+    times_.clear();
+
+    intervalUs_ = intervalUs;
+    running_ = true;
+    stopping_ = false;
+    startTime_ = uv_hrtime();
+    *static_cast<Profiler **>(lua_getextraspace(L_)) = this;
+    uv_thread_create(&thread_, Run, this);
+  }
+
+  void Profiler::Stop()
+  {
+    if (!running_)
+    {
+      return;
+    }
+
+    uv_mutex_lock(&mutex_);
+    stopping_ = true;
+    uv_cond_signal(&cond_);
+    uv_mutex_unlock(&mutex_);
+    uv_thread_join(&thread_);
+
+    // the hook may still be armed; like the timer thread, this is allowed
+    // while a script is running (on a worker thread)
+    lua_sethook(L_, NULL, 0, 0);
+
+    uv_mutex_lock(&mutex_);
+    running_ = false;
+    endTime_ = uv_hrtime();
+    uv_mutex_unlock(&mutex_);
+  }
+
+  // 'lua_sethook' is safe to call asynchronously (the standalone
+  // interpreter does it from a signal handler): the running script
+  // notices the count hook at its next instruction.
+  void Profiler::Run(void *arg)
+  {
+    Profiler *p = static_cast<Profiler *>(arg);
+    uint64_t timeout = static_cast<uint64_t>(p->intervalUs_) * 1000;
+
+    uv_mutex_lock(&p->mutex_);
+    while (!p->stopping_)
+    {
+      if (uv_cond_timedwait(&p->cond_, &p->mutex_, timeout) == UV_ETIMEDOUT && !p->stopping_)
+      {
+        lua_sethook(p->L_, Hook, LUA_MASKCOUNT, 1);
+      }
+    }
+    uv_mutex_unlock(&p->mutex_);
+  }
+
+  void Profiler::Hook(lua_State *L, lua_Debug *ar)
+  {
+    Profiler *p = *static_cast<Profiler **>(lua_getextraspace(L));
+    lua_sethook(L, NULL, 0, 0);
+    if (p == NULL)
+    {
+      return;
+    }
+
+    uv_mutex_lock(&p->mutex_);
+    if (p->running_ && !p->stopping_)
+    {
+      p->Sample(L);
+    }
+    uv_mutex_unlock(&p->mutex_);
+  }
+
+  void Profiler::Sample(lua_State *L)
+  {
+    lua_Debug ar[MAX_SAMPLE_DEPTH];
+    int depth = 0;
+    while (depth < MAX_SAMPLE_DEPTH && lua_getstack(L, depth, &ar[depth]))
+    {
+      depth++;
+    }
+
+    int node = 0;
+    for (int level = depth - 1; level >= 0; level--)
+    {
+      lua_getinfo(L, "Sn", &ar[level]);
+      node = Child(node, &ar[level]);
+    }
+
+    nodes_[node].hits++;
+    samples_.push_back(node);
+    times_.push_back(uv_hrtime());
+  }
+
+  // Returns the node for function 'ar' called from 'parent', creating it
+  // the first time it is seen
+  int Profiler::Child(int parent, lua_Debug *ar)
+  {
+    std::string name;
+    if (strcmp(ar->what, "main") == 0)
+    {
+      name = "(main chunk)";
+    }
+    else if (ar->name != NULL)
+    {
+      name = ar->name;
+    }
+    else
+    {
+      name = strcmp(ar->what, "C") == 0 ? "(C function)" : "(anonymous)";
+    }
+
+    std::string key = name + '\n' + ar->short_src + ':' + std::to_string(ar->linedefined);
+    std::map<std::string, int>::iterator it = nodes_[parent].children.find(key);
+    if (it != nodes_[parent].children.end())
+    {
+      return it->second;
+    }
+
+    Node child;
+    child.name = name;
+    child.source = ar->short_src;
+    child.line = ar->linedefined;
+    child.parent = parent;
+    child.hits = 0;
+    int index = static_cast<int>(nodes_.size());
+    nodes_.push_back(child);
+    nodes_[parent].children[key] = index;
+    return index;
+  }
+
+  std::string Profiler::Label(int node) const
+  {
+    const Node &n = nodes_[node];
+    std::string label = n.name + " (" + n.source;
+    if (n.line > 0)
+    {
+      label += ':' + std::to_string(n.line);
+    }
+    label += ')';
+    std::replace(label.begin(), label.end(), ';', ',');
+    return label;
+  }
+
+  // One "outer;...;inner count" line per distinct stack, as consumed by
+  // flamegraph.pl and speedscope
+  std::string Profiler::Folded() const
+  {
+    std::string out;
+    for (size_t i = 1; i < nodes_.size(); i++)
+    {
+      if (nodes_[i].hits == 0)
+      {
+        continue;
+      }
+
+      std::string stack = Label(static_cast<int>(i));
+      for (int p = nodes_[i].parent; p > 0; p = nodes_[p].parent)
+      {
+        stack = Label(p) + ';' + stack;
+      }
+      out += stack + ' ' + std::to_string(nodes_[i].hits) + '\n';
+    }
+    return out;
+  }
+
+  // The format of Chrome DevTools' .cpuprofile files (node ids start at 1,
+  // times are in microseconds)
+  Local<Object> Profiler::CpuProfile(Isolate *isolate) const
+  {
+    Local<Array> nodes = Array::New(isolate, static_cast<uint32_t>(nodes_.size()));
+    for (size_t i = 0; i < nodes_.size(); i++)
+    {
+      const Node &n = nodes_[i];
+
+      Local<Object> frame = Object::New(isolate);
+      Nan::Set(frame, Nan::New("functionName").ToLocalChecked(), Nan::New(n.name).ToLocalChecked());
+      Nan::Set(frame, Nan::New("scriptId").ToLocalChecked(), Nan::New("0").ToLocalChecked());
+      Nan::Set(frame, Nan::New("url").ToLocalChecked(), Nan::New(n.source).ToLocalChecked());
+      Nan::Set(frame, Nan::New("lineNumber").ToLocalChecked(), Nan::New(n.line > 0 ? n.line - 1 : -1));
+      Nan::Set(frame, Nan::New("columnNumber").ToLocalChecked(), Nan::New(-1));
+
+      Local<Array> children = Array::New(isolate, static_cast<uint32_t>(n.children.size()));
+      uint32_t c = 0;
+      for (std::map<std::string, int>::const_iterator it = n.children.begin(); it != n.children.end(); ++it)
+      {
+        Nan::Set(children, c++, Nan::New(it->second + 1));
+      }
+
+      Local<Object> node = Object::New(isolate);
+      Nan::Set(node, Nan::New("id").ToLocalChecked(), Nan::New(static_cast<int>(i) + 1));
+      Nan::Set(node, Nan::New("callFrame").ToLocalChecked(), frame);
+      Nan::Set(node, Nan::New("hitCount").ToLocalChecked(), Nan::New<Number>(static_cast<double>(n.hits)));
+      Nan::Set(node, Nan::New("children").ToLocalChecked(), children);
+      Nan::Set(nodes, static_cast<uint32_t>(i), node);
+    }
+
+    Local<Array> samples = Array::New(isolate, static_cast<uint32_t>(samples_.size()));
+    Local<Array> deltas = Array::New(isolate, static_cast<uint32_t>(times_.size()));
+    uint64_t last = startTime_;
+    for (size_t i = 0; i < samples_.size(); i++)
+    {
+      Nan::Set(samples, static_cast<uint32_t>(i), Nan::New(samples_[i] + 1));
+      Nan::Set(deltas, static_cast<uint32_t>(i), Nan::New<Number>((times_[i] - last) / 1000.0));
+      last = times_[i];
+    }
+
+    Local<Object> profile = Object::New(isolate);
+    Nan::Set(profile, Nan::New("nodes").ToLocalChecked(), nodes);
+    Nan::Set(profile, Nan::New("startTime").ToLocalChecked(), Nan::New<Number>(startTime_ / 1000.0));
+    Nan::Set(profile, Nan::New("endTime").ToLocalChecked(), Nan::New<Number>(endTime_ / 1000.0));
+    Nan::Set(profile, Nan::New("samples").ToLocalChecked(), samples);
+    Nan::Set(profile, Nan::New("timeDeltas").ToLocalChecked(), deltas);
+    return profile;
+  }
+}
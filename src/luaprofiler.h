@@ -0,0 +1,67 @@
+//
+// Sampling profiler for a LuaState (see LuaState#startProfiling)
+//
+
+#ifndef LUAJS_LUAPROFILER_H
+#define LUAJS_LUAPROFILER_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <node.h>
+#include <uv.h>
+
+extern "C" {
+#include "lua/lua.h"
+};
+
+namespace luajs {
+
+  // A timer thread arms a one-shot count hook every intervalUs; the hook
+  // records the Lua stack it interrupts into a call tree and disarms
+  // itself, so the script runs at full speed between samples.
+  class Profiler {
+  public:
+    explicit Profiler(lua_State *L);
+    ~Profiler();
+
+    void Start(int intervalUs);
+    void Stop();
+    bool IsRunning() const { return running_; }
+
+    std::string Folded() const;
+    v8::Local<v8::Object> CpuProfile(v8::Isolate *isolate) const;
+
+  private:
+    struct Node {
+      std::string name;
+      std::string source;
+      int line;
+      int parent;
+      size_t hits;
+      std::map<std::string, int> children;
+    };
+
+    lua_State *L_;
+    uv_thread_t thread_;
+    uv_mutex_t mutex_;
+    uv_cond_t cond_;
+    bool running_;
+    bool stopping_;
+    int intervalUs_;
+    uint64_t startTime_;
+    uint64_t endTime_;
+    std::vector<Node> nodes_;
+    std::vector<int> samples_;
+    std::vector<uint64_t> times_;
+
+    void Sample(lua_State *L);
+    int Child(int parent, lua_Debug *ar);
+    std::string Label(int node) const;
+    static void Run(void *arg);
+    static void Hook(lua_State *L, lua_Debug *ar);
+  };
+}
+
+#endif //LUAJS_LUAPROFILER_H
@@ -5,6 +5,7 @@
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 #include <algorithm>
 #include "luastate.h"
 #include "luajs_utils.h"
@@ -69,6 +70,7 @@ namespace luajs
     HandleScope scope(worker->isolate);
 
     auto resolver = Nan::New(*worker->persistent);
+    worker->state->EndJob();
 
     if (worker->error)
     {
@@ -107,12 +109,18 @@ namespace luajs
     LuaState::instance = instance;
   }
 
-  LuaState::LuaState(lua_State *state, const char *name) : lua_(state), name_(name), isClosed_(false)
+  LuaState::LuaState(lua_State *state, const char *name)
+    : lua_(state), name_(name), isClosed_(false), pendingJobs_(0),
+      gcPrepare_(NULL), gcIdle_(NULL), gcBudgetUs_(0), gcLimitKb_(0),
+      profiler_(NULL)
   {
     luaStateNames.insert(std::string(name));
   }
 
-  LuaState::~LuaState() {}
+  LuaState::~LuaState()
+  {
+    StopIdleGC();
+  }
 
   void LuaState::Init(Local<Object> exports)
   {
@@ -128,6 +136,7 @@ namespace luajs
 
     NODE_SET_PROTOTYPE_METHOD(tpl, "doString", DoString);
     NODE_SET_PROTOTYPE_METHOD(tpl, "doFile", DoFile);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "compileModules", CompileModules);
 
     NODE_SET_PROTOTYPE_METHOD(tpl, "toValue", ToValue);
 
@@ -137,6 +146,14 @@ namespace luajs
     NODE_SET_PROTOTYPE_METHOD(tpl, "setGlobal", SetGlobal);
     NODE_SET_PROTOTYPE_METHOD(tpl, "registerFunction", RegisterFunction);
     NODE_SET_PROTOTYPE_METHOD(tpl, "getStatus", GetStatus);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "gcStats", GcStats);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "setIdleGC", SetIdleGC);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "setJIT", SetJIT);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "reserveStack", ReserveStack);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "setFunctionStats", SetFunctionStats);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "functionStats", FunctionStats);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "startProfiling", StartProfiling);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "stopProfiling", StopProfiling);
 
     //NODE_SET_PROTOTYPE_METHOD(tpl, "loadString", LoadString);
     //NODE_SET_PROTOTYPE_METHOD(tpl, "loadStringSync", LoadStringSync);
@@ -191,9 +208,14 @@ namespace luajs
 
     CHECK_LUA_STATE_IS_OPEN(isolate, obj);
 
+    bool idleGc = obj->gcPrepare_ != NULL;
     obj->Close(args);
     obj->lua_ = luaL_newstate();
     obj->isClosed_ = false;
+    if (idleGc)
+    {
+      obj->StartIdleGC();
+    }
   }
 
   void LuaState::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
@@ -204,6 +226,9 @@ namespace luajs
 
     CHECK_LUA_STATE_IS_OPEN(isolate, obj);
 
+    obj->StopIdleGC();
+    delete obj->profiler_;
+    obj->profiler_ = NULL;
     lua_close(obj->lua_);
     obj->lua_ = NULL;
     obj->isClosed_ = true;
@@ -453,6 +478,234 @@ namespace luajs
     args.GetReturnValue().Set(promise);
   }
 
+  struct CompileBatch;
+
+  // One module of a LuaState#compileModules call, compiled to bytecode in
+  // a scratch state on the thread pool
+  struct CompileUnit
+  {
+    std::string name;
+    std::string chunkname;
+    std::string file;
+    std::string source;
+    std::string bytecode;
+    std::string error;
+    CompileBatch *batch;
+  };
+
+  struct CompileBatch
+  {
+    Isolate *isolate;
+    ResolverPersistent *persistent;
+    luajs::LuaState *state;
+    const char *mode;
+    std::vector<CompileUnit> units;
+    size_t pending;
+  };
+
+  static int WriteBytecode(lua_State *L, const void *p, size_t size, void *ud)
+  {
+    static_cast<std::string *>(ud)->append(static_cast<const char *>(p), size);
+    return 0;
+  }
+
+  static void CompileModuleWork(uv_work_t *req)
+  {
+    CompileUnit *unit = static_cast<CompileUnit *>(req->data);
+    lua_State *L = luaL_newstate();
+    if (L == NULL)
+    {
+      unit->error = "not enough memory";
+      return;
+    }
+
+    int status;
+    if (!unit->file.empty())
+    {
+      status = luaL_loadfilex(L, unit->file.c_str(), unit->batch->mode);
+    }
+    else
+    {
+      status = luaL_loadbufferx(L, unit->source.data(), unit->source.size(), unit->chunkname.c_str(), unit->batch->mode);
+    }
+
+    if (status == LUA_OK)
+    {
+      lua_dump(L, WriteBytecode, &unit->bytecode, 0);
+    }
+    else
+    {
+      unit->error = lua_tostring(L, -1);
+    }
+    lua_close(L);
+  }
+
+  // Undumps the whole batch into the target state, which therefore only
+  // changes if every module compiled
+  void LuaState::FinishCompileBatch(CompileBatch *batch)
+  {
+    HandleScope scope(batch->isolate);
+    auto resolver = Nan::New(*batch->persistent);
+    luajs::LuaState *state = batch->state;
+    state->EndJob();
+
+    std::string error;
+    for (size_t i = 0; i < batch->units.size(); i++)
+    {
+      if (!batch->units[i].error.empty())
+      {
+        error += (error.empty() ? "" : "\n") + batch->units[i].error;
+      }
+    }
+    if (error.empty() && state->IsClosed())
+    {
+      error = "LuaState is closed";
+    }
+
+    if (error.empty())
+    {
+      lua_State *L = state->GetLuaState();
+      int n = static_cast<int>(batch->units.size());
+      luaL_checkstack(L, n + 1, "too many modules");
+      luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+      for (int i = 0; i < n && error.empty(); i++)
+      {
+        CompileUnit &unit = batch->units[i];
+        if (luaL_loadbufferx(L, unit.bytecode.data(), unit.bytecode.size(), unit.chunkname.c_str(), "b") != LUA_OK)
+        {
+          error = lua_tostring(L, -1);
+          lua_settop(L, lua_gettop(L) - i - 1);
+        }
+      }
+      if (error.empty())
+      {
+        for (int i = n - 1; i >= 0; i--)
+        {
+          lua_setfield(L, -2 - i, batch->units[i].name.c_str());
+        }
+      }
+      lua_pop(L, 1);
+    }
+
+    if (error.empty())
+    {
+      Local<Array> names = Array::New(batch->isolate, static_cast<uint32_t>(batch->units.size()));
+      for (size_t i = 0; i < batch->units.size(); i++)
+      {
+        Nan::Set(names, static_cast<uint32_t>(i), Nan::New(batch->units[i].name).ToLocalChecked());
+      }
+      resolver->Resolve(Nan::GetCurrentContext(), names);
+    }
+    else
+    {
+      resolver->Reject(Nan::GetCurrentContext(), Nan::New(error).ToLocalChecked());
+    }
+
+    state->Unref();
+    batch->persistent->Reset();
+    delete batch->persistent;
+    delete batch;
+  }
+
+  void LuaState::CompileModuleAfter(uv_work_t *req, int status)
+  {
+    CompileBatch *batch = static_cast<CompileUnit *>(req->data)->batch;
+    delete req;
+    if (--batch->pending == 0)
+    {
+      FinishCompileBatch(batch);
+    }
+  }
+
+  // Compiles a list of modules ({ name, file } or { name, source }) in
+  // parallel on the libuv thread pool and registers them in package.preload
+  void LuaState::CompileModules(const FunctionCallbackInfo<Value> &args)
+  {
+    Isolate *isolate = args.GetIsolate();
+    HandleScope scope(isolate);
+
+    LuaState *obj = ObjectWrap::Unwrap<LuaState>(args.This());
+
+    CHECK_LUA_STATE_IS_OPEN(isolate, obj);
+
+    if (!args[0]->IsArray())
+    {
+      Nan::ThrowTypeError("LuaState#compileModules takes an array of modules");
+      return;
+    }
+
+    bool optimize = false;
+    if (args[1]->IsObject())
+    {
+      Local<Value> value = Nan::Get(args[1].As<Object>(), Nan::New("optimize").ToLocalChecked()).ToLocalChecked();
+      optimize = value->BooleanValue(isolate);
+    }
+    else if (!args[1]->IsUndefined())
+    {
+      Nan::ThrowTypeError("LuaState#compileModules options must be an object");
+      return;
+    }
+
+    Local<Array> modules = args[0].As<Array>();
+    CompileBatch *batch = new CompileBatch();
+    batch->units.resize(modules->Length());
+    for (uint32_t i = 0; i < modules->Length(); i++)
+    {
+      Local<Value> module = Nan::Get(modules, i).ToLocalChecked();
+      Local<Value> name, file, source;
+      if (module->IsObject())
+      {
+        name = Nan::Get(module.As<Object>(), Nan::New("name").ToLocalChecked()).ToLocalChecked();
+        file = Nan::Get(module.As<Object>(), Nan::New("file").ToLocalChecked()).ToLocalChecked();
+        source = Nan::Get(module.As<Object>(), Nan::New("source").ToLocalChecked()).ToLocalChecked();
+      }
+      if (module->IsObject() && name->IsString() && file->IsString() != source->IsString())
+      {
+        CompileUnit &unit = batch->units[i];
+        unit.name = *String::Utf8Value(isolate, name);
+        if (file->IsString())
+        {
+          unit.file = *String::Utf8Value(isolate, file);
+          unit.chunkname = '@' + unit.file;
+        }
+        else
+        {
+          String::Utf8Value code(isolate, source);
+          unit.source.assign(*code, code.length());
+          unit.chunkname = '=' + unit.name;
+        }
+        unit.batch = batch;
+        continue;
+      }
+
+      delete batch;
+      Nan::ThrowTypeError("LuaState#compileModules modules must have a name and either a file or a source");
+      return;
+    }
+
+    auto resolver = v8::Promise::Resolver::New(isolate->GetCurrentContext()).ToLocalChecked();
+    batch->isolate = isolate;
+    batch->persistent = new ResolverPersistent(resolver);
+    batch->state = obj;
+    batch->mode = optimize ? "bto" : NULL;
+    batch->pending = batch->units.size();
+    obj->Ref();
+    obj->BeginJob();
+    args.GetReturnValue().Set(resolver->GetPromise());
+
+    if (batch->units.empty())
+    {
+      FinishCompileBatch(batch);
+      return;
+    }
+    for (size_t i = 0; i < batch->units.size(); i++)
+    {
+      uv_work_t *req = new uv_work_t;
+      req->data = &batch->units[i];
+      uv_queue_work(uv_default_loop(), req, CompileModuleWork, CompileModuleAfter);
+    }
+  }
+
   void LuaState::GetGlobal(const FunctionCallbackInfo<Value> &args)
   {
     Isolate *isolate = args.GetIsolate();
@@ -510,6 +763,398 @@ namespace luajs
     args.GetReturnValue().Set(Number::New(isolate, status));
   }
 
+  static Local<Array> HistogramToArray(Isolate *isolate, const size_t *hist)
+  {
+    Local<Array> out = Array::New(isolate, LUA_GCSTATBUCKETS);
+    for (int i = 0; i < LUA_GCSTATBUCKETS; i++)
+    {
+      Nan::Set(out, i, Nan::New<Number>(static_cast<double>(hist[i])));
+    }
+    return out;
+  }
+
+  void LuaState::GcStats(const FunctionCallbackInfo<Value> &args)
+  {
+    Isolate *isolate = args.GetIsolate();
+    HandleScope scope(isolate);
+
+    LuaState *obj = ObjectWrap::Unwrap<LuaState>(args.This());
+
+    CHECK_LUA_STATE_IS_OPEN(isolate, obj);
+
+    lua_GCStats stats;
+    bool reset = args.Length() > 0 && args[0]->BooleanValue(isolate);
+    lua_gcstats(obj->GetLuaState(), &stats, reset);
+
+    auto us = [](double ns) { return Nan::New<Number>(ns / 1000.0); };
+    auto count = [](size_t n) { return Nan::New<Number>(static_cast<double>(n)); };
+
+    Local<Object> retn = Object::New(isolate);
+    Nan::Set(retn, Nan::New("cycles").ToLocalChecked(), count(stats.cycles));
+    Nan::Set(retn, Nan::New("fullCycles").ToLocalChecked(), count(stats.fullcycles));
+    Nan::Set(retn, Nan::New("steps").ToLocalChecked(), count(stats.steps));
+    Nan::Set(retn, Nan::New("atomicPhases").ToLocalChecked(), count(stats.atomics));
+    Nan::Set(retn, Nan::New("finalizers").ToLocalChecked(), count(stats.finalizers));
+    Nan::Set(retn, Nan::New("bytesFreed").ToLocalChecked(), count(stats.bytesfreed));
+    Nan::Set(retn, Nan::New("stepTimeUs").ToLocalChecked(), us(stats.steptime));
+    Nan::Set(retn, Nan::New("atomicTimeUs").ToLocalChecked(), us(stats.atomictime));
+    Nan::Set(retn, Nan::New("finalizerTimeUs").ToLocalChecked(), us(stats.fintime));
+    Nan::Set(retn, Nan::New("fullGcTimeUs").ToLocalChecked(), us(stats.fulltime));
+    Nan::Set(retn, Nan::New("idleSteps").ToLocalChecked(), count(stats.idlesteps));
+    Nan::Set(retn, Nan::New("idleTimeUs").ToLocalChecked(), us(stats.idletime));
+    Nan::Set(retn, Nan::New("maxStepUs").ToLocalChecked(), us(stats.maxstep));
+    Nan::Set(retn, Nan::New("maxAtomicUs").ToLocalChecked(), us(stats.maxatomic));
+    Nan::Set(retn, Nan::New("stepHistogram").ToLocalChecked(), HistogramToArray(isolate, stats.stephist));
+    Nan::Set(retn, Nan::New("atomicHistogram").ToLocalChecked(), HistogramToArray(isolate, stats.atomichist));
+    Nan::Set(retn, Nan::New("pause").ToLocalChecked(), Nan::New(stats.pause));
+    Nan::Set(retn, Nan::New("stepmul").ToLocalChecked(), Nan::New(stats.stepmul));
+
+    args.GetReturnValue().Set(retn);
+  }
+
+  void LuaState::SetIdleGC(const FunctionCallbackInfo<Value> &args)
+  {
+    Isolate *isolate = args.GetIsolate();
+    HandleScope scope(isolate);
+
+    LuaState *obj = ObjectWrap::Unwrap<LuaState>(args.This());
+
+    CHECK_LUA_STATE_IS_OPEN(isolate, obj);
+
+    if (args[0]->IsFalse() || args[0]->IsNull())
+    {
+      obj->StopIdleGC();
+      return;
+    }
+
+    int budgetUs = 1000;
+    int limitKb = 32 * 1024;
+    if (args[0]->IsObject())
+    {
+      Local<Object> options = args[0].As<Object>();
+      Local<Value> budget = Nan::Get(options, Nan::New("budgetUs").ToLocalChecked()).ToLocalChecked();
+      Local<Value> limit = Nan::Get(options, Nan::New("limitKb").ToLocalChecked()).ToLocalChecked();
+      if (budget->IsNumber())
+      {
+        budgetUs = Nan::To<int32_t>(budget).FromJust();
+      }
+      if (limit->IsNumber())
+      {
+        limitKb = Nan::To<int32_t>(limit).FromJust();
+      }
+    }
+    else if (!args[0]->IsUndefined() && !args[0]->IsTrue())
+    {
+      Nan::ThrowTypeError("LuaState#setIdleGC takes an options object or a boolean");
+      return;
+    }
+
+    if (budgetUs <= 0 || limitKb <= 0)
+    {
+      Nan::ThrowTypeError("LuaState#setIdleGC budgetUs and limitKb must be positive");
+      return;
+    }
+
+    obj->gcBudgetUs_ = budgetUs;
+    obj->gcLimitKb_ = limitKb;
+    obj->StartIdleGC();
+  }
+
+  void LuaState::SetJIT(const FunctionCallbackInfo<Value> &args)
+  {
+    Isolate *isolate = args.GetIsolate();
+    HandleScope scope(isolate);
+
+    LuaState *obj = ObjectWrap::Unwrap<LuaState>(args.This());
+
+    CHECK_LUA_STATE_IS_OPEN(isolate, obj);
+
+    if (!args[0]->IsBoolean())
+    {
+      Nan::ThrowTypeError("LuaState#setJIT takes a boolean");
+      return;
+    }
+
+    int was = lua_setjit(obj->lua_, args[0]->IsTrue());
+    args.GetReturnValue().Set(was != 0);
+  }
+
+  void LuaState::ReserveStack(const FunctionCallbackInfo<Value> &args)
+  {
+    Isolate *isolate = args.GetIsolate();
+    HandleScope scope(isolate);
+
+    LuaState *obj = ObjectWrap::Unwrap<LuaState>(args.This());
+
+    CHECK_LUA_STATE_IS_OPEN(isolate, obj);
+
+    if (!args[0]->IsNumber() || !args[1]->IsNumber())
+    {
+      Nan::ThrowTypeError("LuaState#reserveStack takes a number of slots and a number of calls");
+      return;
+    }
+
+    int slots = Nan::To<int32_t>(args[0]).FromJust();
+    int calls = Nan::To<int32_t>(args[1]).FromJust();
+    if (slots < 0 || calls < 0 || calls > USHRT_MAX)
+    {
+      Nan::ThrowTypeError("LuaState#reserveStack slots and calls are out of range");
+      return;
+    }
+
+    if (!lua_reservestack(obj->lua_, slots, calls))
+    {
+      Nan::ThrowError("LuaState#reserveStack: cannot reserve that much stack");
+    }
+  }
+
+  void LuaState::SetFunctionStats(const FunctionCallbackInfo<Value> &args)
+  {
+    Isolate *isolate = args.GetIsolate();
+    HandleScope scope(isolate);
+
+    LuaState *obj = ObjectWrap::Unwrap<LuaState>(args.This());
+
+    CHECK_LUA_STATE_IS_OPEN(isolate, obj);
+
+    if (!args[0]->IsBoolean())
+    {
+      Nan::ThrowTypeError("LuaState#setFunctionStats takes a boolean");
+      return;
+    }
+
+    int was = lua_callstats(obj->lua_, args[0]->IsTrue());
+    args.GetReturnValue().Set(was != 0);
+  }
+
+  struct FunctionStatsEntry
+  {
+    double calls;
+    double selfTime;
+    double totalTime;
+  };
+
+  // Functions loaded more than once (e.g. by repeated doString calls of
+  // the same chunk) share a key, so their statistics are added up
+  static void CollectFunctionStats(void *ud, const lua_FuncStats *stats)
+  {
+    std::map<std::string, FunctionStatsEntry> &entries = *static_cast<std::map<std::string, FunctionStatsEntry> *>(ud);
+    FunctionStatsEntry &entry = entries[std::string(stats->source) + ':' + std::to_string(stats->linedefined)];
+    entry.calls += static_cast<double>(stats->calls);
+    entry.selfTime += stats->selftime;
+    entry.totalTime += stats->totaltime;
+  }
+
+  void LuaState::FunctionStats(const FunctionCallbackInfo<Value> &args)
+  {
+    Isolate *isolate = args.GetIsolate();
+    HandleScope scope(isolate);
+
+    LuaState *obj = ObjectWrap::Unwrap<LuaState>(args.This());
+
+    CHECK_LUA_STATE_IS_OPEN(isolate, obj);
+
+    std::map<std::string, FunctionStatsEntry> entries;
+    bool reset = args.Length() > 0 && args[0]->BooleanValue(isolate);
+    lua_funcstats(obj->GetLuaState(), CollectFunctionStats, &entries, reset);
+
+    Local<Object> retn = Object::New(isolate);
+    for (std::map<std::string, FunctionStatsEntry>::iterator it = entries.begin(); it != entries.end(); ++it)
+    {
+      Local<Object> entry = Object::New(isolate);
+      Nan::Set(entry, Nan::New("calls").ToLocalChecked(), Nan::New<Number>(it->second.calls));
+      Nan::Set(entry, Nan::New("selfUs").ToLocalChecked(), Nan::New<Number>(it->second.selfTime / 1000.0));
+      Nan::Set(entry, Nan::New("totalUs").ToLocalChecked(), Nan::New<Number>(it->second.totalTime / 1000.0));
+      Nan::Set(retn, Nan::New(it->first).ToLocalChecked(), entry);
+    }
+
+    args.GetReturnValue().Set(retn);
+  }
+
+  void LuaState::StartProfiling(const FunctionCallbackInfo<Value> &args)
+  {
+    Isolate *isolate = args.GetIsolate();
+    HandleScope scope(isolate);
+
+    LuaState *obj = ObjectWrap::Unwrap<LuaState>(args.This());
+
+    CHECK_LUA_STATE_IS_OPEN(isolate, obj);
+
+    int intervalUs = 1000;
+    if (args[0]->IsObject())
+    {
+      Local<Object> options = args[0].As<Object>();
+      Local<Value> interval = Nan::Get(options, Nan::New("intervalUs").ToLocalChecked()).ToLocalChecked();
+      if (interval->IsNumber())
+      {
+        intervalUs = Nan::To<int32_t>(interval).FromJust();
+      }
+    }
+    else if (!args[0]->IsUndefined())
+    {
+      Nan::ThrowTypeError("LuaState#startProfiling takes an options object");
+      return;
+    }
+
+    if (intervalUs <= 0)
+    {
+      Nan::ThrowTypeError("LuaState#startProfiling intervalUs must be positive");
+      return;
+    }
+
+    if (obj->profiler_ == NULL)
+    {
+      obj->profiler_ = new Profiler(obj->lua_);
+    }
+    else if (obj->profiler_->IsRunning())
+    {
+      Nan::ThrowError("LuaState#startProfiling: the profiler is already running");
+      return;
+    }
+    obj->profiler_->Start(intervalUs);
+  }
+
+  void LuaState::StopProfiling(const FunctionCallbackInfo<Value> &args)
+  {
+    Isolate *isolate = args.GetIsolate();
+    HandleScope scope(isolate);
+
+    LuaState *obj = ObjectWrap::Unwrap<LuaState>(args.This());
+
+    CHECK_LUA_STATE_IS_OPEN(isolate, obj);
+
+    bool cpuprofile = false;
+    if (args[0]->IsString())
+    {
+      String::Utf8Value format(isolate, args[0]);
+      if (strcmp(*format, "cpuprofile") == 0)
+      {
+        cpuprofile = true;
+      }
+      else if (strcmp(*format, "folded") != 0)
+      {
+        Nan::ThrowTypeError("LuaState#stopProfiling format must be 'folded' or 'cpuprofile'");
+        return;
+      }
+    }
+    else if (!args[0]->IsUndefined())
+    {
+      Nan::ThrowTypeError("LuaState#stopProfiling takes a format string");
+      return;
+    }
+
+    if (obj->profiler_ == NULL || !obj->profiler_->IsRunning())
+    {
+      Nan::ThrowError("LuaState#stopProfiling: the profiler is not running");
+      return;
+    }
+
+    obj->profiler_->Stop();
+    if (cpuprofile)
+    {
+      args.GetReturnValue().Set(obj->profiler_->CpuProfile(isolate));
+    }
+    else
+    {
+      args.GetReturnValue().Set(Nan::New(obj->profiler_->Folded()).ToLocalChecked());
+    }
+  }
+
+  // Lua only defers its collection debt while in idle mode; the prepare
+  // handle pays it right before the loop blocks, and the idle handle keeps
+  // the loop spinning (in budgetUs slices) until the debt is paid. The
+  // state is only kept alive while the idle handle is active.
+  void LuaState::StartIdleGC()
+  {
+    lua_gc(lua_, LUA_GCSETIDLE, gcLimitKb_);
+    if (gcPrepare_ != NULL)
+    {
+      return;
+    }
+
+    gcPrepare_ = new uv_prepare_t;
+    gcPrepare_->data = this;
+    uv_prepare_init(uv_default_loop(), gcPrepare_);
+    uv_prepare_start(gcPrepare_, OnGcPrepare);
+    uv_unref(reinterpret_cast<uv_handle_t *>(gcPrepare_));
+
+    gcIdle_ = new uv_idle_t;
+    gcIdle_->data = this;
+    uv_idle_init(uv_default_loop(), gcIdle_);
+    uv_unref(reinterpret_cast<uv_handle_t *>(gcIdle_));
+  }
+
+  void LuaState::StopIdleGC()
+  {
+    if (gcPrepare_ == NULL)
+    {
+      return;
+    }
+
+    if (lua_ != NULL)
+    {
+      lua_gc(lua_, LUA_GCSETIDLE, 0);
+    }
+
+    StopIdleHandle();
+    uv_close(reinterpret_cast<uv_handle_t *>(gcPrepare_), [](uv_handle_t *handle) {
+      delete reinterpret_cast<uv_prepare_t *>(handle);
+    });
+    uv_close(reinterpret_cast<uv_handle_t *>(gcIdle_), [](uv_handle_t *handle) {
+      delete reinterpret_cast<uv_idle_t *>(handle);
+    });
+    gcPrepare_ = NULL;
+    gcIdle_ = NULL;
+  }
+
+  void LuaState::StartIdleHandle()
+  {
+    if (!uv_is_active(reinterpret_cast<uv_handle_t *>(gcIdle_)))
+    {
+      uv_idle_start(gcIdle_, OnGcIdle);
+      Ref();
+    }
+  }
+
+  void LuaState::StopIdleHandle()
+  {
+    if (uv_is_active(reinterpret_cast<uv_handle_t *>(gcIdle_)))
+    {
+      uv_idle_stop(gcIdle_);
+      Unref();
+    }
+  }
+
+  void LuaState::RunIdleGC()
+  {
+    // The state belongs to the thread pool while an async job runs on it
+    if (pendingJobs_ > 0 || isClosed_)
+    {
+      StopIdleHandle();
+      return;
+    }
+
+    // Nothing to do also when the collector is stopped
+    if (lua_gc(lua_, LUA_GCIDLESTEP, gcBudgetUs_))
+    {
+      StopIdleHandle();
+    }
+    else
+    {
+      StartIdleHandle();
+    }
+  }
+
+  void LuaState::OnGcPrepare(uv_prepare_t *handle)
+  {
+    static_cast<LuaState *>(handle->data)->RunIdleGC();
+  }
+
+  void LuaState::OnGcIdle(uv_idle_t *handle)
+  {
+    static_cast<LuaState *>(handle->data)->RunIdleGC();
+  }
+
   // Currently not exported to Node
   void LuaState::LoadStringSync(const FunctionCallbackInfo<Value> &args)
   {
@@ -593,6 +1238,7 @@ namespace luajs
 
     reqData->state = obj;
     obj->Ref();
+    obj->BeginJob();
 
     uv_work_t *req = new uv_work_t;
     req->data = reqData;
@@ -14,6 +14,7 @@
 #include <v8.h>
 #include <uv.h>
 #include <functional>
+#include "luaprofiler.h"
 
 // Lua Headers
 extern "C" {
@@ -25,6 +26,7 @@ extern "C" {
 namespace luajs {
 
   struct async_lua_worker;
+  struct CompileBatch;
 
   class LuaState : public node::ObjectWrap {
   public:
@@ -42,10 +44,19 @@ namespace luajs {
     static void DoStringSync(const v8::FunctionCallbackInfo<v8::Value>& args);
     static void DoFile(const v8::FunctionCallbackInfo<v8::Value>& args);
     static void DoFileSync(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void CompileModules(const v8::FunctionCallbackInfo<v8::Value>& args);
     static void GetGlobal(const v8::FunctionCallbackInfo<v8::Value>& args);
     static void SetGlobal(const v8::FunctionCallbackInfo<v8::Value>& args);
 
     static void GetStatus(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void GcStats(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void SetIdleGC(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void SetJIT(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void ReserveStack(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void SetFunctionStats(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void FunctionStats(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void StartProfiling(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void StopProfiling(const v8::FunctionCallbackInfo<v8::Value>& args);
 
     static void LoadString(const v8::FunctionCallbackInfo<v8::Value>& args);
     static void LoadStringSync(const v8::FunctionCallbackInfo<v8::Value>& args);
@@ -53,6 +64,8 @@ namespace luajs {
     lua_State* GetLuaState() { return lua_; }
     const char* GetName() { return name_; }
     bool IsClosed() { return isClosed_; }
+    void BeginJob() { pendingJobs_++; }
+    void EndJob() { pendingJobs_--; }
     static LuaState* getCurrentInstance();
     static void setCurrentInstance(LuaState*);
 
@@ -63,8 +76,29 @@ namespace luajs {
     std::map<const char*, Nan::Persistent<v8::Function>> functions;
     const char *name_;
     bool isClosed_;
+    int pendingJobs_;
     v8::Isolate* isolate_;
 
+    // Idle-time garbage collection (see LuaState#setIdleGC)
+    uv_prepare_t *gcPrepare_;
+    uv_idle_t *gcIdle_;
+    int gcBudgetUs_;
+    int gcLimitKb_;
+
+    // Sampling profiler (see LuaState#startProfiling)
+    Profiler *profiler_;
+
+    void StartIdleGC();
+    void StopIdleGC();
+    void RunIdleGC();
+    void StartIdleHandle();
+    void StopIdleHandle();
+    static void OnGcPrepare(uv_prepare_t *handle);
+    static void OnGcIdle(uv_idle_t *handle);
+
+    static void FinishCompileBatch(CompileBatch *batch);
+    static void CompileModuleAfter(uv_work_t *req, int status);
+
     v8::Isolate* GetIsolate() { return  isolate_; }
     void SetIsolate(v8::Isolate* isolate) { this->isolate_ = isolate; }
 
@@ -31,4 +31,221 @@ describe('LuaState', function() {
       assert(false, "Shouldn't reach here");
     })
   });
-})
\ No newline at end of file
+
+  it('should compile modules in parallel into package.preload', function() {
+    let lua = new luajs.LuaState();
+    let modules = [
+      { name: 'a', source: 'return { x = 40 }' },
+      { name: 'b', source: 'local a = require("a") return a.x + 2' }
+    ];
+    return lua.compileModules(modules).then(names => {
+      assert.deepEqual(names, ['a', 'b']);
+      assert.equal(lua.doStringSync('return require("b")'), 42);
+      return lua.compileModules([{ name: 'c', source: 'return +' }]);
+    }).then(() => {
+      assert(false, "Shouldn't reach here");
+    }, error => {
+      assert(/^c:1: /.test(error));
+      assert.equal(lua.doStringSync('return package.preload.c'), undefined);
+    });
+  });
+
+  it('should report garbage collector statistics', function() {
+    let lua = new luajs.LuaState();
+    lua.doStringSync('local t = {} for i = 1, 100000 do t[i % 100] = {i} end collectgarbage()');
+    let stats = lua.gcStats();
+    assert(stats.cycles > 0);
+    assert(stats.fullCycles > 0);
+    assert(stats.bytesFreed > 0);
+    assert.equal(stats.stepHistogram.length, stats.atomicHistogram.length);
+    assert.equal(stats.stepHistogram.reduce((a, b) => a + b, 0), stats.steps);
+    lua.gcStats(true);
+    assert.equal(lua.gcStats().cycles, 0);
+  });
+
+  it('should defer garbage collection to idle time', function(done) {
+    let lua = new luajs.LuaState();
+    lua.setIdleGC({ budgetUs: 500, limitKb: 64 * 1024 });
+    lua.gcStats(true);
+    lua.doStringSync('local t = {} for i = 1, 100000 do t[i % 100] = {i} end');
+    assert.equal(lua.gcStats().steps, 0);
+    setTimeout(() => {
+      assert(lua.gcStats().idleSteps > 0);
+      lua.setIdleGC(false);
+      done();
+    }, 50);
+  });
+
+  it('should run optimized chunks like plain ones', function() {
+    let lua = new luajs.LuaState();
+    let result = lua.doStringSync(`
+      local src = [[
+        local t, n = {}, nil
+        if 1 == 1 then t[#t + 1] = 'a' end
+        if 2 < 1 then t[#t + 1] = 'b' end
+        for i = 1, 3 do
+          if i > 1 then goto next end
+          t[#t + 1] = i
+          ::next::
+        end
+        while true do if #t > 0 then break end end
+        return table.concat(t, ',')
+      ]]
+      local plain, optimized = load(src, '=src', 't'), load(src, '=src', 'to')
+      assert(#string.dump(optimized) < #string.dump(plain))
+      return plain() .. '|' .. optimized()`);
+    assert.equal(result, 'a,1|a,1');
+  });
+
+  it('should resume a yielding __index in a fused global lookup', function() {
+    let lua = new luajs.LuaState();
+    let result = lua.doStringSync(`
+      local env = setmetatable({}, {__index = function(t, k) coroutine.yield() return {k} end})
+      local co = coroutine.wrap(function()
+        local _ENV = env
+        return (function() return foo[1] end)()
+      end)
+      co()
+      return co()`);
+    assert.equal(result, 'foo');
+  });
+
+  it('should resume a yielding __add in a fused loop body', function() {
+    let lua = new luajs.LuaState();
+    let result = lua.doStringSync(`
+      local o = setmetatable({}, {__add = function(a, b) coroutine.yield() return 40 + b end})
+      local co = coroutine.wrap(function()
+        local s, n = nil, 0
+        for i = 1, 3 do n = n + 1; s = o + i end
+        return s + n
+      end)
+      local r
+      repeat r = co() until r ~= nil
+      return r`);
+    assert.equal(result, 46);
+  });
+
+  it('should resume a yielding metamethod at a quickened site', function() {
+    let lua = new luajs.LuaState();
+    let result = lua.doStringSync(`
+      local o = setmetatable({}, {
+        __add = function(a, b) coroutine.yield() return 100 end,
+        __lt = function(a, b) coroutine.yield() return true end })
+      local function add(a, b) return a + b end
+      local function lt(a, b) if a < b then return 'yes' end return 'no' end
+      local co = coroutine.wrap(function() return add(o, 1), lt(o, o) end)
+      co()
+      for i = 1, 100 do add(i, 1) end
+      co()
+      for i = 1, 100 do lt(i, i + 1) end
+      local r, l = co()
+      return r .. ',' .. l`);
+    assert.equal(result, '100,yes');
+  });
+
+  it('should keep a reserved stack', function() {
+    let lua = new luajs.LuaState();
+    lua.reserveStack(50000, 2000);
+    let result = lua.doStringSync(`
+      local function deep(n) if n == 0 then return 0 end return 1 + deep(n - 1) end
+      local s = 0
+      for i = 1, 10 do s = s + deep(1500) collectgarbage() end
+      return s`);
+    assert.equal(result, 15000);
+    assert.throws(() => lua.reserveStack(1e9, 0));
+  });
+
+  it('should sort stably', function() {
+    let lua = new luajs.LuaState();
+    let result = lua.doStringSync(`
+      local t = {}
+      for i = 1, 100 do t[i] = { k = i % 3, i = i } end
+      table.stablesort(t, function(a, b) return a.k < b.k end)
+      local n = { 3, 1.5, -2, 10, 0 }
+      table.sort(n)
+      return t[1].i .. ',' .. t[2].i .. ',' .. t[34].i .. '|' .. table.concat(n, ',')`);
+    assert.equal(result, '3,6,1|-2,0,1.5,3,10');
+  });
+
+  it('should keep large tables bounded under insert/delete churn', function() {
+    let lua = new luajs.LuaState();
+    let result = lua.doStringSync(`
+      local t = {}
+      for i = 1, 40000 do t['k' .. i] = i end
+      local function churn(n)
+        for i = 1, n do local k = 'x' .. i; t[k] = i; t[k] = nil end
+        collectgarbage()
+        collectgarbage()
+        return collectgarbage('count')
+      end
+      local before = churn(100000)
+      local after = churn(300000)
+      for i = 1, 40000 do assert(t['k' .. i] == i) end
+      return after / before`);
+    assert(result < 1.25, result);
+  });
+
+  it('should create and clear presized tables', function() {
+    let lua = new luajs.LuaState();
+    let result = lua.doStringSync(`
+      local t = table.create(10, 2)
+      for i = 1, 10 do t[i] = i end
+      t.a, t.b = 1, 2
+      table.clear(t)
+      local empty = next(t) == nil and #t == 0
+      t[1], t.c = 'x', 'y'
+      return tostring(empty) .. ',' .. t[1] .. t.c .. ',' .. tostring(pcall(table.create, -1))`);
+    assert.equal(result, 'true,xy,false');
+  });
+
+  it('should build strings in a strbuf', function() {
+    let lua = new luajs.LuaState();
+    let result = lua.doStringSync(`
+      local b = strbuf.new()
+      for i = 1, 3 do b:put(i, ':'):putf('%.1f;', i / 2) end
+      assert(#b == 18 and b:tostring() == tostring(b))
+      return b`);
+    assert.equal(result, '1:0.5;2:1.0;3:1.5;');
+  });
+
+  it('should pack and unpack numeric arrays', function() {
+    let lua = new luajs.LuaState();
+    let result = lua.doStringSync(`
+      local s = string.packarray('>i2', { 1, -2, 300 })
+      local t, pos = string.unpackarray('>i2', s)
+      return #s .. ',' .. table.concat(t, ',') .. ',' .. pos`);
+    assert.equal(result, '6,1,-2,300,7');
+    result = lua.doStringSync(`
+      local _, e1 = pcall(string.packarray, 'i4', {}, math.mininteger, math.maxinteger)
+      local _, e2 = pcall(string.packarray, 'i4', nil)
+      return e1:match('too large') .. ',' .. e2:match('bad argument #2')`);
+    assert.equal(result, 'too large,bad argument #2');
+  });
+
+  it('should count and time calls per function', function() {
+    let lua = new luajs.LuaState();
+    assert.equal(lua.setFunctionStats(true), false);
+    lua.doStringSync('local function f(n) return n + 1 end\nfor i = 1, 1000 do f(i) end');
+    let stats = lua.functionStats(true);
+    let f = stats['[string "local function f(n) return n + 1 end..."]:1'];
+    assert.equal(f.calls, 1000);
+    assert(f.totalUs >= f.selfUs && f.selfUs >= 0);
+    assert.deepEqual(lua.functionStats(), {});
+    assert.equal(lua.setFunctionStats(false), true);
+  });
+
+  it('should sample the running script', function() {
+    let lua = new luajs.LuaState();
+    lua.doStringSync('function spin() local s = 0 for i = 1, 3e6 do s = s + i end return s end');
+    lua.startProfiling({ intervalUs: 200 });
+    lua.doStringSync('spin()');
+    let folded = lua.stopProfiling();
+    assert(/^\(main chunk\) \(.*\);spin \(.*:1\) \d+$/m.test(folded));
+    lua.startProfiling();
+    lua.doStringSync('spin()');
+    let profile = lua.stopProfiling('cpuprofile');
+    assert.equal(profile.nodes[0].callFrame.functionName, '(root)');
+    assert.equal(profile.samples.length, profile.timeDeltas.length);
+    assert.throws(() => lua.stopProfiling());
+  });
+})